@@ -21,6 +21,19 @@
 
 #include "ObjectAllocator.h"
 #include <cstring> //memset
+#include <cstdlib> //malloc
+#include <vector> //page tallies
+#include <algorithm> //sort
+#include <chrono> //compaction budget
+#include <cstdint> //uintptr_t
+#include <thread> //this_thread
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h> //VirtualAlloc
+#else
+#include <sys/mman.h> //mmap
+#include <unistd.h> //sysconf
+#endif
 #define re_cast reinterpret_cast 
 
 /******************************************************************************/
@@ -30,14 +43,27 @@
 */
 /******************************************************************************/
 ObjectAllocator::ObjectAllocator(size_t ObjectSize, const OAConfig& config) 
- :PageList_(NULL), FreeList_(NULL), _Config(config)
+ :PageList_(NULL), FreeList_(NULL), _Config(config), 
+  StatShards_(!config.RemoteFree_ ? 0 : config.StatShards_ ? config.StatShards_ : DEFAULT_STAT_SHARDS),
+  Owner_(std::this_thread::get_id()), RemoteFrees_(nullptr), RemoteFailed_(false),
+  RemoteCode_(OAException::E_MULTIPLE_FREE), EmptyPages_(0), TrimAt_(),
+  GuardMapSize_(0), GuardSize_(0), GuardOffset_(0),
+  Quarantine_(config.QuarantineSize_), QuarantineHead_(0), QuarantineCount_(0), QuarantineFn_(NULL),
+  PageSpan_(0), PageMask_(0), BlockShift_(0), PressureFn_(NULL),
+  WaitHead_(nullptr), WaitTail_(nullptr), MetaSize_(0), BlockHeader_(config.HBlockInfo_.size_)
 {
+  //split layout: all headers in one array at the start of the page
+  if(_Config.SplitHeaders_)
+  {
+    MetaSize_ = _Config.ObjectsPerPage_ * _Config.HBlockInfo_.size_;
+    BlockHeader_ = 0;
+  }
   //calculate alignment
   if(_Config.Alignment_ > 1) //if there is alignment to do
   {
-    unsigned int leftcheck = static_cast<unsigned int>(sizeof(void*) + _Config.HBlockInfo_.size_ 
+    unsigned int leftcheck = static_cast<unsigned int>(sizeof(void*) + MetaSize_ + BlockHeader_ 
       + _Config.PadBytes_) % _Config.Alignment_ ;
-    unsigned int intercheck = static_cast<unsigned int>(ObjectSize + _Config.HBlockInfo_.size_ 
+    unsigned int intercheck = static_cast<unsigned int>(ObjectSize + BlockHeader_ 
       + (2*_Config.PadBytes_)) % _Config.Alignment_;
 
     if(leftcheck)
@@ -50,14 +76,99 @@ ObjectAllocator::ObjectAllocator(size_t ObjectSize, const OAConfig& config)
     else
       _Config.InterAlignSize_ = 0;
   }
+  //split layout: the first object starts a cache line
+  if(_Config.SplitHeaders_)
+  {
+    size_t Line = _Config.Alignment_ > CACHE_LINE_SIZE ? _Config.Alignment_ : CACHE_LINE_SIZE;
+    size_t First = sizeof(void*) + MetaSize_ + _Config.PadBytes_;
+    _Config.LeftAlignSize_ = static_cast<unsigned>((Line - First % Line) % Line);
+  }
   // Fill up Stats
   //calculate Midblocks
-  midBlockSize = _Config.HBlockInfo_.size_ + (2* _Config.PadBytes_) 
+  midBlockSize = BlockHeader_ + (2* _Config.PadBytes_) 
     + ObjectSize + _Config.InterAlignSize_;
-  _Stats.PageSize_ = sizeof(void *) + _Config.LeftAlignSize_ 
+  _Stats.PageSize_ = sizeof(void *) + MetaSize_ + _Config.LeftAlignSize_ 
     + (_Config.ObjectsPerPage_ * midBlockSize) - _Config.InterAlignSize_;
   _Stats.ObjectSize_ = ObjectSize; 
 
+  //split layout: the stride divides a cache line (or is whole lines) so no 
+  //payload straddles one (an Alignment_ that isn't a power of two wins)
+  if(_Config.SplitHeaders_ && (_Config.Alignment_ & (_Config.Alignment_ - 1)) == 0)
+  {
+    size_t Stride = 1;
+    if(midBlockSize < CACHE_LINE_SIZE)
+    {
+      while(Stride < midBlockSize)
+        Stride <<= 1;
+    }
+    else
+      Stride = (midBlockSize + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+    _Config.InterAlignSize_ += static_cast<unsigned>(Stride - midBlockSize);
+    midBlockSize = Stride;
+    _Stats.PageSize_ = sizeof(void *) + MetaSize_ + _Config.LeftAlignSize_ 
+      + (_Config.ObjectsPerPage_ * midBlockSize) - _Config.InterAlignSize_;
+  }
+  //power-of-two stride on pages aligned to their own power-of-two size
+  if(_Config.AlignedPages_)
+  {
+    size_t Stride = 1;
+    while(Stride < midBlockSize)
+    {
+      Stride <<= 1;
+      BlockShift_++;
+    }
+    _Config.InterAlignSize_ += static_cast<unsigned>(Stride - midBlockSize);
+    midBlockSize = Stride;
+    _Stats.PageSize_ = sizeof(void *) + MetaSize_ + _Config.LeftAlignSize_ 
+      + (_Config.ObjectsPerPage_ * midBlockSize) - _Config.InterAlignSize_;
+  }
+  //pages aligned to their own power-of-two size: a block's page is a mask away
+  if(_Config.AlignedPages_ || _Config.SplitHeaders_)
+  {
+    PageSpan_ = sizeof(void *);
+    while(PageSpan_ < _Stats.PageSize_)
+    {
+      PageSpan_ <<= 1;
+    }
+    PageMask_ = ~static_cast<uintptr_t>(PageSpan_ - 1);
+  }
+  //shared pages must hold a whole page of this allocator
+  if(_Config.Provider_)
+  {
+    size_t Needed = PageMask_ ? PageSpan_ : _Stats.PageSize_;
+    if(_Config.Provider_ -> GetPageSize() < Needed || 
+      (PageMask_ && _Config.Provider_ -> GetPageSize() != Needed))
+    {
+      throw OAException(OAException::E_NO_MEMORY,"Provider pages do not fit this allocator");
+    }
+  }
+  //quarantine lookups never allocate
+  if(_Config.QuarantineSize_)
+  {
+    Quarantined_.Reserve(_Config.QuarantineSize_);
+  }
+
+  //guarded pages end right before an inaccessible OS page
+  if(_Config.GuardPages_)
+  {
+#ifdef _WIN32
+    SYSTEM_INFO Info;
+    GetSystemInfo(&Info);
+    size_t OSPage = Info.dwPageSize;
+#else
+    size_t OSPage = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+    size_t Usable = (_Stats.PageSize_ + OSPage - 1) / OSPage * OSPage;
+    GuardSize_ = OSPage;
+    GuardMapSize_ = Usable + OSPage;
+    //flush against the guard, the first block only moves for Alignment_
+    GuardOffset_ = Usable - _Stats.PageSize_;
+    if(_Config.Alignment_ > 1)
+    {
+      GuardOffset_ = GuardOffset_ / _Config.Alignment_ * _Config.Alignment_;
+    }
+  }
+
   //If using CPP mm
   if(_Config.UseCPPMemManager_)
   {
@@ -78,6 +189,14 @@ ObjectAllocator::~ObjectAllocator()
 {
   if(_Config.UseCPPMemManager_)
   {
+    //blocks other threads freed are still queued
+    GenericObject *Batch = RemoteFrees_.exchange(nullptr, std::memory_order_acquire);
+    while(Batch != nullptr)
+    {
+      GenericObject *Next = Batch -> Next;
+      free(Batch);
+      Batch = Next;
+    }
     return;
   }
 
@@ -86,7 +205,7 @@ ObjectAllocator::~ObjectAllocator()
   while(PageList_!=NULL)
   {
     Page = PageList_ -> Next;
-    delete PageList_;
+    Free_PageMemory(PageList_);
     PageList_ = Page;
   }
 }
@@ -102,21 +221,34 @@ void *ObjectAllocator::Create_NewPage()
   try
   { 
     //Allocate memory for new page
-    void *Page = malloc(_Stats.PageSize_);
-    void *LeftAlign = re_cast<char*>(Page) + sizeof(void*);
+    bool OverBudget = false;
+    void *Page = Alloc_PageMemory(&OverBudget);
+    if(Page == nullptr)
+    {
+      if(OverBudget)
+      {
+        throw OAException(OAException::E_NO_PAGES,"Page provider budget has been reached");
+      }
+      throw std::bad_alloc();
+    }
+    void *LeftAlign = re_cast<char*>(Page) + sizeof(void*) + MetaSize_;
+    bool Sampling = _Config.DebugSampleRate_ > 1;
   
     //DEBUGON
     if(_Config.DebugOn_ == true)
     {
-      memset(Page, UNALLOCATED_PATTERN, _Stats.PageSize_); //whole page
+      if(!Sampling)
+        memset(Page, UNALLOCATED_PATTERN, _Stats.PageSize_); //whole page
       memset(LeftAlign, ALIGN_PATTERN, _Config.LeftAlignSize_); //Left align
     }
+    //split headers
+    memset(re_cast<char*>(Page) + sizeof(void*), 0, MetaSize_);
     
     //update to next ptr
     re_cast<GenericObject*>(Page) -> Next = NULL;
     //update blocks
     void *header = re_cast<char*>(LeftAlign) + _Config.LeftAlignSize_;
-    void *leftPAD = re_cast<char*>(header) + _Config.HBlockInfo_.size_;
+    void *leftPAD = re_cast<char*>(header) + BlockHeader_;
     void *object = re_cast<char*>(leftPAD) + _Config.PadBytes_;
     void *rightPAD = re_cast<char*>(object) + _Stats.ObjectSize_;
     void *interAlign = re_cast<char*>(rightPAD) + _Config.PadBytes_;
@@ -125,10 +257,12 @@ void *ObjectAllocator::Create_NewPage()
     for(size_t i = 0; i < _Config.ObjectsPerPage_; i++)
     {
       //Update header
-      memset(header, 0, _Config.HBlockInfo_.size_); 
+      memset(header, 0, BlockHeader_); 
       //Update Memory Signature
-      if(_Config.DebugOn_ == true)
+      if(Is_Sampled(object))
       {
+        if(Sampling)
+          memset(object, UNALLOCATED_PATTERN, _Stats.ObjectSize_);
         //Padding
         memset(leftPAD, PAD_PATTERN, _Config.PadBytes_);
         memset(rightPAD, PAD_PATTERN, _Config.PadBytes_);
@@ -149,8 +283,18 @@ void *ObjectAllocator::Create_NewPage()
       interAlign = re_cast<char*>(interAlign) + midBlockSize;
     }
     //Update stats
-    _Stats.FreeObjects_ = _Config.ObjectsPerPage_;
+    _Stats.FreeObjects_ += _Config.ObjectsPerPage_;
     _Stats.PagesInUse_++;
+    //aligned pages are found by masking, Free checks the result here
+    if(PageMask_ != 0)
+    {
+      PageSet_.Insert(Page);
+    }
+    //the page starts out empty
+    if(_Config.TrimPolicy_.AutoTrim_ || _Config.TrimPolicy_.EmptySeconds_ > 0.0)
+    {
+      Start_Clock(re_cast<GenericObject*>(Page));
+    }
     //return the new allocated page
     return Page;
   }
@@ -175,9 +319,54 @@ void *ObjectAllocator::Create_NewPage()
 */
 /******************************************************************************/
 void *ObjectAllocator::Allocate(const char* label) 
+{
+  return Allocate_Block(label, true);
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function is Allocate without exceptions. When no block 
+   can be had it returns NULL instead of throwing.
+
+  \param label
+   Pointer to a const char
+
+  \return 
+   void pointer (NULL if out of pages or memory)
+*/
+/******************************************************************************/
+void *ObjectAllocator::TryAllocate(const char* label) 
+{
+  return Allocate_Block(label, false);
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function takes a block off the free list for Allocate and 
+   TryAllocate. Without Throw, running out of pages or memory returns NULL 
+   and the errors remote frees turn up are kept for a later drain.
+
+  \param label
+   Pointer to a const char
+
+  \param Throw
+   throw on failure instead of returning NULL
+
+  \return 
+   void pointer
+*/
+/******************************************************************************/
+void *ObjectAllocator::Allocate_Block(const char* label, bool Throw) 
 {
   if(_Config.UseCPPMemManager_ == true)
   {
+    //blocks other threads freed are released here
+    if(_Config.RemoteFree_ && RemoteFrees_.load(std::memory_order_relaxed) != nullptr)
+    {
+      Drain_Remote(Throw);
+    }
     //update stats
     _Stats.Allocations_++;
     _Stats.ObjectsInUse_++;
@@ -185,21 +374,17 @@ void *ObjectAllocator::Allocate(const char* label)
       _Stats.MostObjects_ = _Stats.ObjectsInUse_;
     return malloc(_Stats.ObjectSize_); 
   }
-  //Check if No available memory left
-  if((FreeList_==nullptr) && (_Config.MaxPages_ != 0) && 
-    (_Stats.PagesInUse_ >= _Config.MaxPages_) )
-  {
-    throw OAException(OAException::E_NO_PAGES,"New pages has been reached");
-  }
-  //create new page if needed
-  if(FreeList_==nullptr)
+  //refill the free list if needed (throws, or gives NULL, if it can't)
+  if(FreeList_==nullptr && !Refill_FreeList(Throw))
   {
-    GenericObject* newPage = re_cast<GenericObject*>(Create_NewPage());
-    newPage -> Next = PageList_;
-    PageList_ = newPage;
+    return nullptr;
   }
   void* object = FreeList_;
   FreeList_ = FreeList_ -> Next;
+  if(!Clocks_.empty() && Clock_Of(object).FreeCount-- == _Config.ObjectsPerPage_)
+  {
+    EmptyPages_--;
+  }
 
   //update stats
   _Stats.ObjectsInUse_++; 
@@ -208,42 +393,52 @@ void *ObjectAllocator::Allocate(const char* label)
 
   if(_Stats.MostObjects_ < _Stats.ObjectsInUse_)
     _Stats.MostObjects_ = _Stats.ObjectsInUse_;
+
+  //give back the pages that have been empty long enough, never the one the 
+  //block came from
+  if(_Config.TrimPolicy_.AutoTrim_ && Trim_Due())
+  {
+    Trim();
+  }
   
-  if(_Config.DebugOn_)
+  if(Is_Sampled(object))
   {
     memset(object, ALLOCATED_PATTERN, _Stats.ObjectSize_);
   }
 
   //update header
   bool* _flag;
-  short* _useCount;
-  int* _alloc_Num;
+  char* _useCount;
+  char* _alloc_Num;
+  unsigned long long AllocNum = _Stats.Allocations_;
+  unsigned short UseCount;
   MemBlockInfo** header;
+  char* HeaderEnd = Header_Of(object) + _Config.HBlockInfo_.size_;
 
+  //headers are not aligned, the 64-bit numbers are copied in
   if(_Config.HBlockInfo_.type_ == OAConfig::hbBasic)
   {
-    _flag = re_cast<bool*>(re_cast<char*>(object)
-    - (_Config.PadBytes_ + sizeof(bool)));
+    _flag = re_cast<bool*>(HeaderEnd - sizeof(bool));
     *_flag = true;
-    _alloc_Num = re_cast<int*>(re_cast<char*>(_flag)-sizeof(int));
-    *_alloc_Num = _Stats.Allocations_;
+    _alloc_Num = re_cast<char*>(_flag) - sizeof(AllocNum);
+    memcpy(_alloc_Num, &AllocNum, sizeof(AllocNum));
   }
 
   if(_Config.HBlockInfo_.type_ == OAConfig::hbExtended)
   {
-    _flag = re_cast<bool*>(re_cast<char*>(object)
-    - (_Config.PadBytes_ + sizeof(bool)));
+    _flag = re_cast<bool*>(HeaderEnd - sizeof(bool));
     *_flag = true;
-    _alloc_Num = re_cast<int*>(re_cast<short*>(_flag) - sizeof(short));
-    *_alloc_Num = _Stats.Allocations_;
-    _useCount = re_cast<short*>(re_cast<char*>(_alloc_Num) - sizeof(short));
-    (*_useCount)++; 
+    _alloc_Num = re_cast<char*>(_flag) - sizeof(AllocNum);
+    memcpy(_alloc_Num, &AllocNum, sizeof(AllocNum));
+    _useCount = _alloc_Num - sizeof(UseCount);
+    memcpy(&UseCount, _useCount, sizeof(UseCount));
+    UseCount++;
+    memcpy(_useCount, &UseCount, sizeof(UseCount));
   }
 
   if(_Config.HBlockInfo_.type_ == OAConfig::hbExternal)
   {
-    header = re_cast<MemBlockInfo**>(re_cast<char*>(object)
-    - (_Config.PadBytes_ + _Config.HBlockInfo_.size_));
+    header = re_cast<MemBlockInfo**>(Header_Of(object));
     (*header) = re_cast<MemBlockInfo*>(malloc(sizeof(MemBlockInfo)));
     (*header) -> in_use = true;
     (*header) -> alloc_num = _Stats.Allocations_;
@@ -259,6 +454,214 @@ void *ObjectAllocator::Allocate(const char* label)
   return object;
 } 
 
+/******************************************************************************/
+/*!
+  \brief
+   The following function sets the function called when the allocator runs 
+   short of pages. The handler may Free, Trim or FreeEmptyPages on this 
+   allocator (or others) but must not Allocate from it.
+
+  \param fn
+   function to call (PRESSURECALLBACK), NULL for none
+*/
+/******************************************************************************/
+void ObjectAllocator::SetPressureCallback(PRESSURECALLBACK fn)
+{
+  PressureFn_ = fn;
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function is the slow path of Allocate, run when the free 
+   list is empty. It takes back remote frees first. Past the soft limit it 
+   asks the pressure handler for memory and takes back a quarantined block 
+   before it grows; at the hard limit (MaxPages_ or the provider budget) 
+   it asks once more and then fails.
+
+  \param Throw
+   throw on failure instead of returning false
+
+  \return
+   true if the free list has a block
+*/
+/******************************************************************************/
+bool ObjectAllocator::Refill_FreeList(bool Throw)
+{
+  //Take back the blocks other threads freed
+  if(_Config.RemoteFree_ && RemoteFrees_.load(std::memory_order_relaxed) != nullptr)
+  {
+    Drain_Remote(Throw);
+    if(FreeList_ != nullptr)
+      return true;
+  }
+  //Past the soft limit, give the client a chance before growing
+  bool Soft = _Config.SoftMaxPages_ != 0 && _Stats.PagesInUse_ >= _Config.SoftMaxPages_;
+  if(Soft && PressureFn_ && !At_PageLimit())
+  {
+    PressureFn_(*this, plSoft);
+    if(FreeList_ != nullptr)
+      return true;
+  }
+  if(At_PageLimit() && PressureFn_)
+  {
+    PressureFn_(*this, plHard);
+    if(FreeList_ != nullptr)
+      return true;
+  }
+  //Short of pages, take back the oldest quarantined block
+  if((Soft || At_PageLimit()) && QuarantineCount_)
+  {
+    Release_Quarantined();
+    return true;
+  }
+  //Check if No available memory left
+  if(At_PageLimit())
+  {
+    if(!Throw)
+      return false;
+    throw OAException(OAException::E_NO_PAGES,"New pages has been reached");
+  }
+  //create new page
+  GenericObject* newPage;
+  try
+  {
+    newPage = re_cast<GenericObject*>(Create_NewPage());
+  }
+  catch(OAException&)
+  {
+    if(Throw)
+      throw;
+    return false;
+  }
+  newPage -> Next = PageList_;
+  PageList_ = newPage;
+  return true;
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function gives free blocks to the waiting coroutines, 
+   oldest first, and resumes them. With the free list empty it refills it 
+   the way Allocate would (remote frees, quarantined blocks, a new page if 
+   the limits allow). A waiter is unlinked before it resumes since its 
+   awaiter lives in the coroutine frame.
+*/
+/******************************************************************************/
+void ObjectAllocator::Serve_Waiters()
+{
+#ifdef OA_COROUTINES
+  while(WaitHead_ != nullptr)
+  {
+    if(FreeList_ == nullptr)
+    {
+      if(!Refill_FreeList(false))
+        break;
+      //a Free from the pressure handler may have served the queue meanwhile
+      continue;
+    }
+    AllocateAwaiter *Waiter = WaitHead_;
+    WaitHead_ = Waiter -> Next_;
+    if(WaitHead_ == nullptr)
+      WaitTail_ = nullptr;
+    Waiter -> Block_ = Allocate(Waiter -> Label_);
+    Waiter -> Handle_.resume();
+  }
+#endif
+}
+
+#ifdef OA_COROUTINES
+/******************************************************************************/
+/*!
+  \brief
+   The following function returns an awaitable for a block. The coroutine 
+   only suspends when the allocator is out of pages; it then waits, in 
+   FIFO order with the other waiters, for a Free to hand it a block.
+
+  \param label
+   Pointer to a const char
+
+  \return 
+   the awaitable, co_await gives the block
+*/
+/******************************************************************************/
+ObjectAllocator::AllocateAwaiter ObjectAllocator::AllocateAsync(const char* label)
+{
+  return AllocateAwaiter(*this, label);
+}
+
+/******************************************************************************/
+/*!
+  \brief
+    The constructor for the AllocateAwaiter class
+
+  \param oa
+   the allocator
+
+  \param label
+   Pointer to a const char
+*/
+/******************************************************************************/
+ObjectAllocator::AllocateAwaiter::AllocateAwaiter(ObjectAllocator &oa, const char *label)
+ :OA_(oa), Label_(label), Block_(nullptr), Next_(nullptr)
+{
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function tries to allocate without suspending. It never 
+   jumps ahead of coroutines already waiting.
+
+  \return
+   true if a block was allocated
+*/
+/******************************************************************************/
+bool ObjectAllocator::AllocateAwaiter::await_ready()
+{
+  if(OA_.WaitHead_ != nullptr)
+  {
+    return false;
+  }
+  Block_ = OA_.TryAllocate(Label_);
+  return Block_ != nullptr;
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function puts the coroutine at the back of the wait queue
+
+  \param Handle
+   the suspended coroutine
+*/
+/******************************************************************************/
+void ObjectAllocator::AllocateAwaiter::await_suspend(std::coroutine_handle<> Handle)
+{
+  Handle_ = Handle;
+  if(OA_.WaitTail_ != nullptr)
+    OA_.WaitTail_ -> Next_ = this;
+  else
+    OA_.WaitHead_ = this;
+  OA_.WaitTail_ = this;
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function returns the block
+
+  \return 
+   void pointer
+*/
+/******************************************************************************/
+void *ObjectAllocator::AllocateAwaiter::await_resume()
+{
+  return Block_;
+}
+#endif
+
 /******************************************************************************/
 /*!
   \brief
@@ -275,16 +678,46 @@ void *ObjectAllocator::Allocate(const char* label)
 /******************************************************************************/
 void ObjectAllocator::Free(void *Object) 
 {
+  //frees from other threads wait for the owner, CPP mm blocks too since 
+  //only the owner may touch the stats; they are counted in a shard
+  if(_Config.RemoteFree_ && std::this_thread::get_id() != Owner_)
+  {
+    Count_Deallocation();
+    Push_Remote(Object);
+    return;
+  }
   //update stats
   _Stats.Deallocations_++;
   //CPP mm to free object
   if(_Config.UseCPPMemManager_ == true)
   {
     free(Object);
+    _Stats.ObjectsInUse_--;
     return;
   }
+  Free_Block(Object);
+  //hand the block to the oldest coroutine waiting for one
+  if(WaitHead_ != nullptr)
+  {
+    Serve_Waiters();
+  }
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function returns a block to the free list on the owner 
+   thread. Throws an exception if the object can't be freed.
+
+  \param Object
+  void pointer
+*/
+/******************************************************************************/
+void ObjectAllocator::Free_Block(void *Object)
+{
   //debug check
-  if(_Config.DebugOn_ == true)
+  bool Checked = Is_Sampled(Object);
+  if(Checked)
   {
     GenericObject* temp = FreeList_;
     while(temp!=nullptr)
@@ -295,25 +728,34 @@ void ObjectAllocator::Free(void *Object)
       }
       temp = temp -> Next;
     }
+    if(Is_Quarantined(Object))
+    {
+      throw OAException(OAException::E_MULTIPLE_FREE,"Object is already Free");
+    }
     // Check for object Range
-    GenericObject *Page = PageList_;
-    void *header = re_cast<char*>(Page) + sizeof(void*) + _Config.LeftAlignSize_;
-    void *OBJ = re_cast<char*>(header) + _Config.HBlockInfo_.size_ + _Config.PadBytes_;
-    void *EndofPage = re_cast<char*>(Page) + _Stats.PageSize_;
     bool OutofBound = true;
-
-    while(Page)
+    if(PageMask_ != 0)
+    {
+      //the page is a mask away (and one lookup), the slot a shift (or a division)
+      GenericObject *Page = re_cast<GenericObject*>(re_cast<uintptr_t>(Object) & PageMask_);
+      size_t Check = re_cast<char*>(Object) - First_Block(Page);
+      size_t Misaligned = _Config.AlignedPages_ ? (Check & (midBlockSize - 1)) : (Check % midBlockSize);
+      bool OnPage = PageSet_.Has(Page);
+      OutofBound = !OnPage || Misaligned != 0 || Slot_Of(Page, Object) >= _Config.ObjectsPerPage_;
+    }
+    else
     {
-      size_t Check = re_cast<char*>(Object) - re_cast<char*>(OBJ);
-      if((Object >= header) && (Object < EndofPage) && ((Check % midBlockSize) == 0))
+      for(GenericObject *Page = PageList_; Page != nullptr; Page = Page -> Next)
       {
-        OutofBound = false;
-        break;
+        char *OBJ = First_Block(Page);
+        char *EndofPage = re_cast<char*>(Page) + _Stats.PageSize_;
+        size_t Check = re_cast<char*>(Object) - OBJ;
+        if((Object >= OBJ) && (Object < EndofPage) && ((Check % midBlockSize) == 0))
+        {
+          OutofBound = false;
+          break;
+        }
       }
-      Page = Page-> Next;
-      header = re_cast<char*>(Page) + sizeof(void*) + _Config.LeftAlignSize_;
-      OBJ = re_cast<char*>(header)  + _Config.PadBytes_ + _Config.HBlockInfo_.size_;
-      EndofPage = re_cast<char*>(Page) + _Stats.PageSize_;
     }
     if(OutofBound)
     {
@@ -322,7 +764,7 @@ void ObjectAllocator::Free(void *Object)
     //Check for pad corruption
     unsigned char *leftPAD = re_cast<unsigned char*>(Object) - _Config.PadBytes_;
     unsigned char *rightPAD = re_cast<unsigned char*>(Object) + _Stats.ObjectSize_;
-    for(size_t i = 1; i < _Config.PadBytes_; i++)
+    for(size_t i = 0; i < _Config.PadBytes_; i++)
     {
       if(*leftPAD != PAD_PATTERN || *rightPAD != PAD_PATTERN)
       {
@@ -333,20 +775,21 @@ void ObjectAllocator::Free(void *Object)
     }
   }
   //update memory signature
-  if(_Config.DebugOn_ == true)
+  if(Checked)
   {
     memset(Object, FREED_PATTERN, _Stats.ObjectSize_);
   }
 
-  //update list
-  re_cast<GenericObject*>(Object)->Next = FreeList_;
-  FreeList_ = re_cast<GenericObject*>(Object);
+  //update list (signed blocks wait in the quarantine first)
+  if(Checked && !Quarantine_.empty())
+    Quarantine_Block(Object);
+  else
+    Push_Free(Object);
 
   //Update Object Header
   if(_Config.HBlockInfo_.type_ == OAConfig::HBLOCK_TYPE::hbExternal)
   {
-    void *header = re_cast<char*>(Object) - 
-      (_Config.PadBytes_ + _Config.HBlockInfo_.size_);
+    void *header = Header_Of(Object);
     MemBlockInfo** MemBlockInfoPTR = re_cast<MemBlockInfo**>(header);
     if((*MemBlockInfoPTR) -> label)
       free((*MemBlockInfoPTR) -> label);
@@ -355,12 +798,18 @@ void ObjectAllocator::Free(void *Object)
   }
   else if(_Config.HBlockInfo_.type_!= OAConfig::HBLOCK_TYPE::hbNone)
   {
-    memset(re_cast<char*>(Object) - (_Config.PadBytes_ + sizeof(int) + sizeof(bool)),
-     0, (sizeof(int) + sizeof(bool)));
+    memset(Header_Of(Object) + _Config.HBlockInfo_.size_ - (sizeof(unsigned long long) + sizeof(bool)),
+     0, (sizeof(unsigned long long) + sizeof(bool)));
   }
   //update stats
-  _Stats.FreeObjects_++;
   _Stats.ObjectsInUse_--;
+
+  //give empty pages back once there are more than the spare pages (and 
+  //one held back by EmptySeconds_ is old enough)
+  if(_Config.TrimPolicy_.AutoTrim_ && Trim_Due())
+  {
+    Trim();
+  }
 }
 
 /******************************************************************************/
@@ -383,8 +832,32 @@ unsigned ObjectAllocator::DumpMemoryInUse(DUMPCALLBACK fn) const
   //loop through pages
   while(Page != nullptr)
   {
-    void* header = re_cast<char*>(Page) + sizeof(void*) + _Config.LeftAlignSize_;
-    void* object = re_cast<char*>(header) + _Config.HBlockInfo_.size_ + _Config.PadBytes_;
+    void* object = First_Block(Page);
+    //split headers: read the in-use flags off the metadata array in order
+    if(_Config.SplitHeaders_ && _Config.HBlockInfo_.type_ != OAConfig::hbNone)
+    {
+      const char* Meta = re_cast<char*>(Page) + sizeof(void*);
+      for(size_t i = 0; i<_Config.ObjectsPerPage_; i++)
+      {
+        bool InUse;
+        if(_Config.HBlockInfo_.type_ == OAConfig::hbExternal)
+        {
+          MemBlockInfo* Info;
+          memcpy(&Info, Meta, sizeof(Info));
+          InUse = Info != NULL;
+        }
+        else
+          InUse = Meta[_Config.HBlockInfo_.size_ - 1] != 0;
+        if(InUse)
+        {
+          fn(object,_Stats.ObjectSize_);
+        }
+        Meta += _Config.HBlockInfo_.size_;
+        object = re_cast<char*>(object) + midBlockSize;
+      }
+      Page = Page -> Next;
+      continue;
+    }
     for(size_t i = 0; i<_Config.ObjectsPerPage_; i++)
     {     
       //check if block in use
@@ -399,7 +872,7 @@ unsigned ObjectAllocator::DumpMemoryInUse(DUMPCALLBACK fn) const
         }
         tempFreeList = tempFreeList -> Next;
       }
-      if(InUSE == false)
+      if(InUSE == false && !Is_Quarantined(object))
       {
         fn(object,_Stats.ObjectSize_);
       }
@@ -437,10 +910,15 @@ unsigned ObjectAllocator::ValidatePages(VALIDATECALLBACK fn) const
   //Loop through pages
   while(Page != nullptr)
   {
-    void *header = re_cast<char*>(Page) + _Config.LeftAlignSize_ + sizeof(void*) ;
-    void *object = re_cast<char*>(header) + _Config.PadBytes_ + _Config.HBlockInfo_.size_ ;
+    void *object = First_Block(Page);
     for(size_t i = 0; i < _Config.ObjectsPerPage_; i++)
     {
+      //Only sampled blocks carry signatures
+      if(!Is_Sampled(object))
+      {
+        object = re_cast<char*>(object) + midBlockSize;
+        continue;
+      }
       //If padding is corrupted
       unsigned char *leftPAD = re_cast<unsigned char*>(object) - _Config.PadBytes_;
       unsigned char *rightPAD = re_cast<unsigned char*>(object) + _Stats.ObjectSize_;
@@ -467,116 +945,1279 @@ unsigned ObjectAllocator::ValidatePages(VALIDATECALLBACK fn) const
 /******************************************************************************/
 /*!
   \brief
-   The following function frees all empty pages(?)
+   The following function makes the calling thread the owner of the 
+   allocator. Only the owner allocates; with remote frees on, frees from 
+   other threads are queued for it.
+*/
+/******************************************************************************/
+void ObjectAllocator::SetOwnerThread()
+{
+  Owner_ = std::this_thread::get_id();
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function takes back the blocks other threads freed and 
+   hands them to the coroutines waiting for one
 
   \return
-   unsigned
+   number of blocks taken back
 */
 /******************************************************************************/
-unsigned ObjectAllocator::FreeEmptyPages()
+unsigned ObjectAllocator::DrainRemoteFrees()
 {
-  unsigned PagesFree = 0;
-  //if CPP mm true 
-  if(_Config.UseCPPMemManager_|| !PageList_)
+  unsigned Drained = Drain_Remote(true);
+  if(WaitHead_ != nullptr)
   {
-    return 0;
+    Serve_Waiters();
   }
-  //loop through all pages
-  GenericObject *tempPageList = PageList_;
-  GenericObject *prevPageList = tempPageList;
-  //Loop through page
-  while(tempPageList!=nullptr)
-  {
-    void *header = re_cast<char*>(tempPageList)  + _Config.LeftAlignSize_ + sizeof(void*);
-    void *first_Object = re_cast<char*>(header) + _Config.PadBytes_ + _Config.HBlockInfo_.size_;
-    void *object = first_Object;
-    unsigned NoObjectNotUse = 0;
+  return Drained;
+}
 
-    for(size_t i = 0; i < _Config.ObjectsPerPage_; i++)
+/******************************************************************************/
+/*!
+  \brief
+   The following function takes the whole remote-free list in one exchange 
+   and frees its blocks on the owner thread. Every block is processed even 
+   if one of them fails the debug checks; the first error is thrown after. 
+   A drain that must not throw keeps the error for the next one that may.
+
+  \param Throw
+   throw the first error (this drain's or a kept one) instead of keeping it
+
+  \return
+   number of blocks taken back
+*/
+/******************************************************************************/
+unsigned ObjectAllocator::Drain_Remote(bool Throw)
+{
+  GenericObject *Batch = RemoteFrees_.exchange(nullptr, std::memory_order_acquire);
+  unsigned Drained = 0;
+  //every queued block is in use, more than that means a block was queued twice
+  unsigned Limit = _Stats.ObjectsInUse_;
+
+  while(Batch != nullptr)
+  {
+    if(Drained == Limit)
     {
-      //check for object in use
-      GenericObject *tempFreeList = FreeList_;
-      while(tempFreeList != nullptr)
+      //the rest of the list may loop back, it is dropped
+      if(!RemoteFailed_)
       {
-        if(tempFreeList == object)
-        {
-          NoObjectNotUse++;
-          break;
-        }
-        tempFreeList = tempFreeList -> Next;
+        RemoteFailed_ = true;
+        RemoteCode_ = OAException::E_MULTIPLE_FREE;
+        RemoteMessage_ = "Object was freed twice by other threads";
       }
-      //go next block
-      object = re_cast<char*>(object) + midBlockSize;
+      break;
     }
-    //check if all object in page not in use
-    if(NoObjectNotUse == _Config.ObjectsPerPage_)
+    GenericObject *Next = Batch -> Next;
+    try
     {
-      //Remove object from freelist
-     object = first_Object;
-      for(size_t i = 0; i < _Config.ObjectsPerPage_; i++)
+      if(_Config.UseCPPMemManager_)
       {
-        //find objeect in freelist
-        GenericObject *tmpFreeList = FreeList_;
-        GenericObject *prevFreeList = tmpFreeList;
-        while(tmpFreeList)
-        {
-          if(tmpFreeList == object)
-          {
-            if(tmpFreeList == FreeList_)
-            {
-              FreeList_ = FreeList_ -> Next;
-            }
-            else
-              prevFreeList -> Next = (*tmpFreeList).Next;
-            break;
-          }
-          prevFreeList = tmpFreeList;
-          tmpFreeList = tmpFreeList -> Next;
-        }
-        //go next object
-        object = re_cast<char*>(object) + midBlockSize;
+        free(Batch);
+        _Stats.ObjectsInUse_--;
       }
-      //free header
-      if(_Config.HBlockInfo_.type_ == OAConfig::HBLOCK_TYPE::hbExternal)
+      else
+        Free_Block(Batch);
+    }
+    catch(OAException &e)
+    {
+      if(!RemoteFailed_)
       {
-        MemBlockInfo** MemPTR = re_cast<MemBlockInfo**>(re_cast<char*>(tempPageList) 
-        + _Config.LeftAlignSize_ + sizeof(void*) );
-        for(size_t i = 0; i < _Config.ObjectsPerPage_; ++i)
-        {
-          MemBlockInfo* toFree = *MemPTR;
-          MemPTR = re_cast<MemBlockInfo**>(re_cast<char*>(MemPTR) + midBlockSize);
-          free(toFree -> label);
-          free(toFree);
-        }
+        RemoteFailed_ = true;
+        RemoteCode_ = e.code();
+        RemoteMessage_ = e.what();
+      }
+    }
+    Drained++;
+    Batch = Next;
+  }
+  if(RemoteFailed_ && Throw)
+  {
+    RemoteFailed_ = false;
+    throw OAException(RemoteCode_, RemoteMessage_);
+  }
+  return Drained;
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function queues a block freed by another thread. It is a 
+   lock-free push that any number of threads can do at once.
+
+  \param Object
+   the block
+*/
+/******************************************************************************/
+void ObjectAllocator::Push_Remote(void *Object)
+{
+  GenericObject *Node = re_cast<GenericObject*>(Object);
+  GenericObject *Head = RemoteFrees_.load(std::memory_order_relaxed);
+  do
+  {
+    if(Head == Node)
+    {
+      throw OAException(OAException::E_MULTIPLE_FREE,"Object is already Free");
+    }
+    Node -> Next = Head;
+  } while(!RemoteFrees_.compare_exchange_weak(Head, Node, 
+    std::memory_order_release, std::memory_order_relaxed));
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function frees all empty pages
+
+  \return
+   number of pages freed
+*/
+/******************************************************************************/
+unsigned ObjectAllocator::FreeEmptyPages()
+{
+  return Release_EmptyPages(0, 0.0);
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function frees the empty pages allowed by the trim policy
+
+  \return
+   number of pages freed
+*/
+/******************************************************************************/
+unsigned ObjectAllocator::Trim()
+{
+  return Release_EmptyPages(_Config.TrimPolicy_.SparePages_, 
+    _Config.TrimPolicy_.EmptySeconds_);
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function moves live blocks from the sparsest pages into the 
+   holes of the densest pages and then frees the pages that were emptied. 
+   The payload is copied before the callback runs; the callback updates the 
+   client's references and returns true, or returns false to keep the block 
+   where it is. The free list is rebuilt densest page first afterwards and 
+   the emptied pages beyond the spare pages of the trim policy are freed. 
+   If the callback throws, the moves made so far stand, the free list is 
+   rebuilt and the exception is passed on.
+
+  \param fn
+   function to call for each proposed move (RELOCATECALLBACK)
+
+  \param MaxMoves
+   maximum number of blocks to move (0 = no limit)
+
+  \param MaxSeconds
+   maximum time to spend moving blocks (0 = no limit)
+
+  \return
+   number of blocks moved
+*/
+/******************************************************************************/
+unsigned ObjectAllocator::Compact(RELOCATECALLBACK fn, unsigned MaxMoves, double MaxSeconds)
+{
+  unsigned Moves = 0;
+  if(_Config.UseCPPMemManager_ || !PageList_ || !fn)
+  {
+    return Moves;
+  }
+  //blocks freed remotely must not look live
+  if(_Config.RemoteFree_)
+  {
+    Drain_Remote(false);
+  }
+  std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now();
+
+  //free slots of every page
+  std::vector<PageTally> Pages;
+  Tally_Pages(Pages);
+
+  //only partially used pages take part, sparsest first
+  std::vector<PageTally*> Partial;
+  for(size_t i = 0; i < Pages.size(); i++)
+  {
+    if(Pages[i].FreeCount > 0 && Pages[i].FreeCount < _Config.ObjectsPerPage_)
+      Partial.push_back(&Pages[i]);
+  }
+  std::sort(Partial.begin(), Partial.end(), [](const PageTally *a, const PageTally *b)
+  {
+    return a -> FreeCount > b -> FreeCount;
+  });
+
+  size_t Src = 0;
+  size_t Dst = Partial.empty() ? 0 : Partial.size() - 1;
+  size_t SrcSlot = 0;
+  size_t DstSlot = 0;
+  while(Src < Dst)
+  {
+    PageTally *From = Partial[Src];
+    PageTally *To = Partial[Dst];
+    if(To -> FreeCount == 0)
+    {
+      Dst--;
+      DstSlot = 0;
+      continue;
+    }
+    //next live block on the sparse page
+    while(SrcSlot < _Config.ObjectsPerPage_ && From -> FreeSlot[SrcSlot])
+      SrcSlot++;
+    if(SrcSlot == _Config.ObjectsPerPage_)
+    {
+      Src++;
+      SrcSlot = 0;
+      continue;
+    }
+    char *OldObj = First_Block(From -> Page) + SrcSlot * midBlockSize;
+    //quarantined blocks belong to nobody, they stay
+    if(Is_Quarantined(OldObj))
+    {
+      SrcSlot++;
+      continue;
+    }
+    //next hole on the dense page
+    while(!To -> FreeSlot[DstSlot])
+      DstSlot++;
+
+    char *NewObj = First_Block(To -> Page) + DstSlot * midBlockSize;
+    memcpy(NewObj, OldObj, _Stats.ObjectSize_);
+    bool Moved;
+    try
+    {
+      Moved = fn(OldObj, NewObj, _Stats.ObjectSize_);
+    }
+    catch(...)
+    {
+      //the copy overwrote the link of a free block, put the list back together
+      if(Is_Sampled(NewObj))
+      {
+        memset(NewObj, FREED_PATTERN, _Stats.ObjectSize_);
       }
-      //free page list
-      GenericObject *PageToFree = tempPageList;
-      if(tempPageList == PageList_)
+      Relink_FreeList(Pages);
+      throw;
+    }
+    if(Moved)
+    {
+      //header moves with the block, the old slot becomes a free block
+      char *OldHeader = Header_Of(OldObj);
+      memcpy(Header_Of(NewObj), OldHeader, _Config.HBlockInfo_.size_);
+      if(_Config.HBlockInfo_.type_ == OAConfig::hbExternal)
+      {
+        memset(OldHeader, 0, _Config.HBlockInfo_.size_);
+      }
+      else if(_Config.HBlockInfo_.type_ != OAConfig::hbNone)
       {
-        PageList_ = PageList_ -> Next;
-        tempPageList = PageList_;
-        prevPageList = tempPageList;
+        memset(OldHeader + _Config.HBlockInfo_.size_ - (sizeof(unsigned long long) + sizeof(bool)),
+          0, (sizeof(unsigned long long) + sizeof(bool)));
       }
-      else 
+      if(Is_Sampled(OldObj))
       {
-        prevPageList -> Next = tempPageList -> Next;
-        tempPageList = prevPageList -> Next;
+        memset(OldObj, FREED_PATTERN, _Stats.ObjectSize_);
       }
-      free(PageToFree);
-      //Update the stats
-      _Stats.FreeObjects_ = _Stats.FreeObjects_ - _Config.ObjectsPerPage_; 
-      _Stats.PagesInUse_--;
+      From -> FreeSlot[SrcSlot] = 1;
+      From -> FreeCount++;
+      To -> FreeSlot[DstSlot] = 0;
+      To -> FreeCount--;
+      Moves++;
+    }
+    else if(Is_Sampled(NewObj))
+    {
+      //refused, the block stays and the hole stays free
+      memset(NewObj, FREED_PATTERN, _Stats.ObjectSize_);
+    }
+    SrcSlot++;
+
+    //check budget
+    if(MaxMoves != 0 && Moves >= MaxMoves)
+      break;
+    if(MaxSeconds > 0.0 && std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - Start).count() >= MaxSeconds)
+      break;
+  }
+
+  //rebuild the free list so the densest pages are handed out first
+  Relink_FreeList(Pages);
+
+  //release emptied pages
+  Release_EmptyPages(_Config.TrimPolicy_.SparePages_, 0.0);
+  return Moves;
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function rebuilds the free list from the free slots of 
+   every page, densest page first so those are handed out first, and 
+   recounts the page clocks (blocks moved between pages)
+
+  \param Pages
+   free slots of every page (Tally_Pages, updated by the moves)
+*/
+/******************************************************************************/
+void ObjectAllocator::Relink_FreeList(std::vector<PageTally> &Pages)
+{
+  std::sort(Pages.begin(), Pages.end(), [](const PageTally &a, const PageTally &b)
+  {
+    return a.FreeCount > b.FreeCount;
+  });
+  FreeList_ = nullptr;
+  for(size_t i = 0; i < Pages.size(); i++)
+  {
+    char *object = First_Block(Pages[i].Page);
+    for(size_t j = 0; j < _Config.ObjectsPerPage_; j++)
+    {
+      if(Pages[i].FreeSlot[j])
+      {
+        re_cast<GenericObject*>(object) -> Next = FreeList_;
+        FreeList_ = re_cast<GenericObject*>(object);
+      }
+      object += midBlockSize;
+    }
+  }
+
+  //blocks moved between pages, recount them
+  if(!Clocks_.empty())
+  {
+    TimePoint Now = std::chrono::steady_clock::now();
+    EmptyPages_ = 0;
+    for(size_t i = 0; i < Pages.size(); i++)
+    {
+      PageClock &Clock = Clock_Of(Pages[i].Page);
+      if(Pages[i].FreeCount == _Config.ObjectsPerPage_ && Clock.FreeCount != _Config.ObjectsPerPage_)
+        Clock.EmptySince = Now;
+      Clock.FreeCount = Pages[i].FreeCount;
+      if(Clock.FreeCount == _Config.ObjectsPerPage_)
+        EmptyPages_++;
+    }
+  }
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function gets the memory for one page. A guarded page is 
+   mapped so that it ends right before an inaccessible OS page, which makes 
+   an overflow off the last block fault at once (with one object per page 
+   every block is guarded). Aligned and split-header pages are aligned to 
+   their power-of-two size instead and are never guarded. With a page provider the page comes 
+   from (and counts against) the provider.
+
+  \param OverBudget
+   set to true if the provider's budget is why there is no page
+
+  \return
+   the memory for the page (NULL if there is none)
+*/
+/******************************************************************************/
+void *ObjectAllocator::Alloc_PageMemory(bool *OverBudget)
+{
+  if(_Config.Provider_)
+  {
+    return _Config.Provider_ -> Acquire(OverBudget);
+  }
+  if(PageMask_ != 0)
+  {
+#ifdef _WIN32
+    return _aligned_malloc(PageSpan_, PageSpan_);
+#else
+    void *Page = NULL;
+    return posix_memalign(&Page, PageSpan_, PageSpan_) == 0 ? Page : NULL;
+#endif
+  }
+  if(!_Config.GuardPages_)
+  {
+    return malloc(_Stats.PageSize_);
+  }
+#ifdef _WIN32
+  char *Map = re_cast<char*>(VirtualAlloc(NULL, GuardMapSize_, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+  DWORD OldProtect;
+  if(Map == NULL)
+  {
+    return NULL;
+  }
+  //an unguarded page would hide the overflows it is there to catch
+  if(!VirtualProtect(Map + GuardMapSize_ - GuardSize_, GuardSize_, PAGE_NOACCESS, &OldProtect))
+  {
+    VirtualFree(Map, 0, MEM_RELEASE);
+    return NULL;
+  }
+#else
+  void *Mapped = mmap(NULL, GuardMapSize_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(Mapped == MAP_FAILED)
+  {
+    return NULL;
+  }
+  char *Map = re_cast<char*>(Mapped);
+  //an unguarded page would hide the overflows it is there to catch
+  if(mprotect(Map + GuardMapSize_ - GuardSize_, GuardSize_, PROT_NONE) != 0)
+  {
+    munmap(Map, GuardMapSize_);
+    return NULL;
+  }
+#endif
+  return Map + GuardOffset_;
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function tells if no more pages may be created: the page 
+   provider's budget when there is one, MaxPages_ otherwise
+
+  \return
+   true if the page limit has been reached
+*/
+/******************************************************************************/
+bool ObjectAllocator::At_PageLimit() const
+{
+  if(_Config.Provider_)
+  {
+    return _Config.Provider_ -> AtBudget();
+  }
+  return (_Config.MaxPages_ != 0) && (_Stats.PagesInUse_ >= _Config.MaxPages_);
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function gives the memory of a page back to the system
+
+  \param Page
+   the page
+*/
+/******************************************************************************/
+void ObjectAllocator::Free_PageMemory(void *Page)
+{
+  if(_Config.Provider_)
+  {
+    _Config.Provider_ -> Release(Page);
+    return;
+  }
+  if(PageMask_ != 0)
+  {
+#ifdef _WIN32
+    _aligned_free(Page);
+#else
+    free(Page);
+#endif
+    return;
+  }
+  if(!_Config.GuardPages_)
+  {
+    free(Page);
+    return;
+  }
+  char *Map = re_cast<char*>(Page) - GuardOffset_;
+#ifdef _WIN32
+  VirtualFree(Map, 0, MEM_RELEASE);
+#else
+  munmap(Map, GuardMapSize_);
+#endif
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function tells if the debugging code runs on a block. With 
+   a sample rate of N only 1 in N blocks (picked by address, so a block is 
+   either always or never sampled) gets signatures and checks.
+
+  \param Object
+   the block
+
+  \return
+   true if the block is checked
+*/
+/******************************************************************************/
+bool ObjectAllocator::Is_Sampled(const void *Object) const
+{
+  if(!_Config.DebugOn_)
+  {
+    return false;
+  }
+  if(_Config.DebugSampleRate_ <= 1)
+  {
+    return true;
+  }
+  uintptr_t Block = _Config.AlignedPages_ ? re_cast<uintptr_t>(Object) >> BlockShift_ 
+    : re_cast<uintptr_t>(Object) / midBlockSize;
+  unsigned long long Hash = Block * 0x9E3779B97F4A7C15ULL;
+  return (Hash >> 32) % _Config.DebugSampleRate_ == 0;
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function returns the first block of a page
+
+  \param Page
+   the page
+
+  \return
+   pointer to the first block of the page
+*/
+/******************************************************************************/
+char *ObjectAllocator::First_Block(GenericObject *Page) const
+{
+  return re_cast<char*>(Page) + sizeof(void*) + MetaSize_ + _Config.LeftAlignSize_ 
+    + BlockHeader_ + _Config.PadBytes_;
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function returns the header of a block: right before its 
+   left pad, or its entry in the page's metadata array with split headers
+
+  \param Object
+   the block
+
+  \return
+   pointer to the header of the block
+*/
+/******************************************************************************/
+char *ObjectAllocator::Header_Of(void *Object) const
+{
+  if(!_Config.SplitHeaders_)
+  {
+    return re_cast<char*>(Object) - (_Config.PadBytes_ + _Config.HBlockInfo_.size_);
+  }
+  GenericObject *Page = re_cast<GenericObject*>(re_cast<uintptr_t>(Object) & PageMask_);
+  return re_cast<char*>(Page) + sizeof(void*) + Slot_Of(Page, Object) * _Config.HBlockInfo_.size_;
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function returns the slot of a block on its page
+
+  \param Page
+   the page
+
+  \param Object
+   a block on the page
+
+  \return
+   the index of the block on the page
+*/
+/******************************************************************************/
+size_t ObjectAllocator::Slot_Of(GenericObject *Page, const void *Object) const
+{
+  size_t Offset = re_cast<const char*>(Object) - First_Block(Page);
+  return _Config.AlignedPages_ ? Offset >> BlockShift_ : Offset / midBlockSize;
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function unlinks a page from the page list and frees it. 
+   The blocks of the page must already be off the free list.
+
+  \param Page
+   the page to free
+
+  \param Prev
+   the page before it in the page list (NULL if it is the first page)
+*/
+/******************************************************************************/
+void ObjectAllocator::Release_Page(GenericObject *Page, GenericObject *Prev)
+{
+  if(Prev)
+    Prev -> Next = Page -> Next;
+  else
+    PageList_ = Page -> Next;
+  if(!Clocks_.empty())
+  {
+    PageClock &Clock = Clock_Of(Page);
+    if(Clock.FreeCount == _Config.ObjectsPerPage_)
+      EmptyPages_--;
+    Clocks_.erase(Clocks_.begin() + (&Clock - &Clocks_[0]));
+  }
+  if(PageMask_ != 0)
+  {
+    PageSet_.Erase(Page);
+  }
+  Free_PageMemory(Page);
+  //Update the stats
+  _Stats.FreeObjects_ = _Stats.FreeObjects_ - _Config.ObjectsPerPage_;
+  _Stats.PagesInUse_--;
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function counts the free blocks of every page. The pages 
+   are sorted by address so Tally_Of can find the page of a block.
+
+  \param Pages
+   the tallies to fill
+*/
+/******************************************************************************/
+void ObjectAllocator::Tally_Pages(std::vector<PageTally> &Pages) const
+{
+  Pages.clear();
+  for(GenericObject *Page = PageList_; Page != nullptr; Page = Page -> Next)
+  {
+    PageTally Tally;
+    Tally.Page = Page;
+    Tally.FreeCount = 0;
+    Tally.FreeSlot.assign(_Config.ObjectsPerPage_, 0);
+    Tally.Release = false;
+    Pages.push_back(Tally);
+  }
+  std::sort(Pages.begin(), Pages.end(), [](const PageTally &a, const PageTally &b)
+  {
+    return std::less<GenericObject*>()(a.Page, b.Page);
+  });
+  //bin the free list
+  for(GenericObject *Obj = FreeList_; Obj != nullptr; Obj = Obj -> Next)
+  {
+    PageTally &Tally = Tally_Of(Pages, Obj);
+    size_t Slot = Slot_Of(Tally.Page, Obj);
+    Tally.FreeSlot[Slot] = 1;
+    Tally.FreeCount++;
+  }
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function finds the tally of the page holding an address
+
+  \param Pages
+   the tallies, sorted by address
+
+  \param Address
+   an address on one of the pages
+
+  \return
+   the tally of the page
+*/
+/******************************************************************************/
+ObjectAllocator::PageTally &ObjectAllocator::Tally_Of(std::vector<PageTally> &Pages, 
+  const void *Address)
+{
+  size_t lo = 0;
+  size_t hi = Pages.size();
+  while(hi - lo > 1)
+  {
+    size_t mid = (lo + hi) / 2;
+    if(std::less<const void*>()(Address, Pages[mid].Page))
+      hi = mid;
+    else
+      lo = mid;
+  }
+  return Pages[lo];
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function frees empty pages. The pages that have been empty 
+   the longest go first; the Keep most recently emptied pages and the pages 
+   that have been empty for less than MinSeconds stay.
+
+  \param Keep
+   number of empty pages to keep
+
+  \param MinSeconds
+   how long a page must have been empty to be freed
+
+  \return
+   number of pages freed
+*/
+/******************************************************************************/
+unsigned ObjectAllocator::Release_EmptyPages(unsigned Keep, double MinSeconds)
+{
+  unsigned PagesFree = 0;
+  if(_Config.UseCPPMemManager_ || !PageList_)
+  {
+    return PagesFree;
+  }
+  if(_Config.RemoteFree_)
+  {
+    Drain_Remote(false);
+  }
+  //tracked pages know their free blocks, no need to count them
+  if(!Clocks_.empty())
+  {
+    return Release_TrackedPages(Keep, MinSeconds);
+  }
+  std::vector<PageTally> Pages;
+  Tally_Pages(Pages);
+
+  //untracked pages have no age, the first ones in address order go
+  unsigned Empty = 0;
+  for(size_t i = 0; i < Pages.size(); i++)
+  {
+    if(Pages[i].FreeCount == _Config.ObjectsPerPage_)
+      Empty++;
+  }
+  unsigned Picked = 0;
+  for(size_t i = 0; i < Pages.size() && Picked + Keep < Empty; i++)
+  {
+    if(Pages[i].FreeCount == _Config.ObjectsPerPage_)
+    {
+      Pages[i].Release = true;
+      Picked++;
+    }
+  }
+  if(Picked == 0)
+  {
+    return PagesFree;
+  }
+
+  //drop their blocks from the free list
+  GenericObject **Link = &FreeList_;
+  while(*Link != nullptr)
+  {
+    if(Tally_Of(Pages, *Link).Release)
+      *Link = (*Link) -> Next;
+    else
+      Link = &(*Link) -> Next;
+  }
+  //free the pages
+  GenericObject *Prev = nullptr;
+  GenericObject *Page = PageList_;
+  while(Page != nullptr)
+  {
+    GenericObject *Next = Page -> Next;
+    if(Tally_Of(Pages, Page).Release)
+    {
+      Release_Page(Page, Prev);
       PagesFree++;
     }
     else
+      Prev = Page;
+    Page = Next;
+  }
+  return PagesFree;
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function frees empty pages using the page clocks, which 
+   keep the free blocks of every page up to date. Nothing is allocated and 
+   the free list is only walked until the blocks of the freed pages are off 
+   it. Same policy as Release_EmptyPages.
+
+  \param Keep
+   number of empty pages to keep
+
+  \param MinSeconds
+   how long a page must have been empty to be freed
+
+  \return
+   number of pages freed
+*/
+/******************************************************************************/
+unsigned ObjectAllocator::Release_TrackedPages(unsigned Keep, double MinSeconds)
+{
+  //every empty page goes but the Keep most recently emptied ones
+  for(size_t i = 0; i < Clocks_.size(); i++)
+  {
+    Clocks_[i].Release = Clocks_[i].FreeCount == _Config.ObjectsPerPage_;
+  }
+  for(unsigned k = 0; k < Keep; k++)
+  {
+    PageClock *Youngest = nullptr;
+    for(size_t i = 0; i < Clocks_.size(); i++)
+    {
+      if(Clocks_[i].Release && (!Youngest || !(Clocks_[i].EmptySince < Youngest -> EmptySince)))
+        Youngest = &Clocks_[i];
+    }
+    if(!Youngest)
+      break;
+    Youngest -> Release = false;
+  }
+  //and those that have not been empty long enough, the oldest of them is 
+  //due first
+  TimePoint Now = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::duration Min = 
+    std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(MinSeconds));
+  TimePoint Due = TimePoint();
+  unsigned Picked = 0;
+  for(size_t i = 0; i < Clocks_.size(); i++)
+  {
+    PageClock &Clock = Clocks_[i];
+    if(!Clock.Release)
+      continue;
+    if(MinSeconds > 0.0 && Now - Clock.EmptySince < Min)
+    {
+      Clock.Release = false;
+      if(Due == TimePoint() || Clock.EmptySince + Min < Due)
+        Due = Clock.EmptySince + Min;
+      continue;
+    }
+    Picked++;
+  }
+  TrimAt_ = Due;
+  if(Picked == 0)
+  {
+    return 0;
+  }
+
+  //drop their blocks from the free list
+  size_t Left = static_cast<size_t>(Picked) * _Config.ObjectsPerPage_;
+  GenericObject **Link = &FreeList_;
+  while(Left)
+  {
+    if(Clock_Of(*Link).Release)
+    {
+      *Link = (*Link) -> Next;
+      Left--;
+    }
+    else
+      Link = &(*Link) -> Next;
+  }
+  //free the pages
+  unsigned PagesFree = 0;
+  GenericObject *Prev = nullptr;
+  GenericObject *Page = PageList_;
+  while(PagesFree < Picked)
+  {
+    GenericObject *Next = Page -> Next;
+    if(Clock_Of(Page).Release)
+    {
+      Release_Page(Page, Prev);
+      PagesFree++;
+    }
+    else
+      Prev = Page;
+    Page = Next;
+  }
+  return PagesFree;
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function gives every quarantined block back to the free 
+   list, checking each one on the way out
+
+  \return
+   number of blocks released
+*/
+/******************************************************************************/
+unsigned ObjectAllocator::FlushQuarantine()
+{
+  unsigned Released = 0;
+  while(QuarantineCount_)
+  {
+    Release_Quarantined();
+    Released++;
+  }
+  if(WaitHead_ != nullptr)
+  {
+    Serve_Waiters();
+  }
+  return Released;
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function sets the function called for a quarantined block 
+   that was written to after it was freed
+
+  \param fn
+   function to call (QUARANTINECALLBACK), NULL for none
+*/
+/******************************************************************************/
+void ObjectAllocator::SetQuarantineCallback(QUARANTINECALLBACK fn)
+{
+  QuarantineFn_ = fn;
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function puts a block on the free list
+
+  \param Object
+   the block
+*/
+/******************************************************************************/
+void ObjectAllocator::Push_Free(void *Object)
+{
+  re_cast<GenericObject*>(Object) -> Next = FreeList_;
+  FreeList_ = re_cast<GenericObject*>(Object);
+  _Stats.FreeObjects_++;
+  //the last block of a page is back, the page is empty from now on
+  if(!Clocks_.empty())
+  {
+    PageClock &Clock = Clock_Of(Object);
+    if(++Clock.FreeCount == _Config.ObjectsPerPage_)
+    {
+      EmptyPages_++;
+      Clock.EmptySince = std::chrono::steady_clock::now();
+      if(TrimAt_ == TimePoint())
+      {
+        TrimAt_ = Clock.EmptySince + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<double>(_Config.TrimPolicy_.EmptySeconds_));
+      }
+    }
+  }
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function starts tracking a new (empty) page, keeping the 
+   clocks sorted by address
+
+  \param Page
+   the page
+*/
+/******************************************************************************/
+void ObjectAllocator::Start_Clock(GenericObject *Page)
+{
+  PageClock Clock;
+  Clock.Page = Page;
+  Clock.FreeCount = _Config.ObjectsPerPage_;
+  Clock.EmptySince = std::chrono::steady_clock::now();
+  Clock.Release = false;
+  std::vector<PageClock>::iterator Where = std::upper_bound(Clocks_.begin(), Clocks_.end(), Clock, 
+    [](const PageClock &a, const PageClock &b)
+  {
+    return std::less<GenericObject*>()(a.Page, b.Page);
+  });
+  Clocks_.insert(Where, Clock);
+  EmptyPages_++;
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function finds the clock of the page holding an address
+
+  \param Address
+   an address on one of the pages
+
+  \return
+   the clock of the page
+*/
+/******************************************************************************/
+ObjectAllocator::PageClock &ObjectAllocator::Clock_Of(const void *Address)
+{
+  size_t lo = 0;
+  size_t hi = Clocks_.size();
+  while(hi - lo > 1)
+  {
+    size_t mid = (lo + hi) / 2;
+    if(std::less<const void*>()(Address, Clocks_[mid].Page))
+      hi = mid;
+    else
+      lo = mid;
+  }
+  return Clocks_[lo];
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function tells if Free/Allocate should trim: there are more 
+   empty pages than the spare pages and, with EmptySeconds_, one held back 
+   has become old enough. A trim walks the free list, so it waits until the 
+   extra pages hold an eighth of the free blocks (TRIM_BATCH); that keeps 
+   the walks to a constant cost per block given back.
+
+  \return
+   true if a trim is due
+*/
+/******************************************************************************/
+bool ObjectAllocator::Trim_Due() const
+{
+  if(EmptyPages_ <= _Config.TrimPolicy_.SparePages_)
+  {
+    return false;
+  }
+  size_t Extra = static_cast<size_t>(EmptyPages_ - _Config.TrimPolicy_.SparePages_) * _Config.ObjectsPerPage_;
+  if(Extra * TRIM_BATCH < _Stats.FreeObjects_)
+  {
+    return false;
+  }
+  if(_Config.TrimPolicy_.EmptySeconds_ <= 0.0)
+  {
+    return true;
+  }
+  return TrimAt_ != TimePoint() && std::chrono::steady_clock::now() >= TrimAt_;
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function puts a freed block at the back of the quarantine. 
+   When the quarantine is full the oldest block leaves it first.
+
+  \param Object
+   the block (already signed with FREED_PATTERN)
+*/
+/******************************************************************************/
+void ObjectAllocator::Quarantine_Block(void *Object)
+{
+  if(QuarantineCount_ == Quarantine_.size())
+  {
+    Release_Quarantined();
+  }
+  size_t Tail = (QuarantineHead_ + QuarantineCount_) % Quarantine_.size();
+  Quarantine_[Tail] = re_cast<GenericObject*>(Object);
+  Quarantined_.Insert(Object);
+  QuarantineCount_++;
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function takes the oldest block out of the quarantine, 
+   reports it if its FREED_PATTERN was overwritten and puts it on the free 
+   list
+*/
+/******************************************************************************/
+void ObjectAllocator::Release_Quarantined()
+{
+  GenericObject *Object = Quarantine_[QuarantineHead_];
+  QuarantineHead_ = (QuarantineHead_ + 1) % Quarantine_.size();
+  Quarantined_.Erase(Object);
+  QuarantineCount_--;
+  if(!Has_Pattern(Object, FREED_PATTERN) && QuarantineFn_)
+  {
+    QuarantineFn_(Object, _Stats.ObjectSize_);
+  }
+  Push_Free(Object);
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function tells if a block is in the quarantine
+
+  \param Object
+   the block
+
+  \return
+   true if the block is quarantined
+*/
+/******************************************************************************/
+bool ObjectAllocator::Is_Quarantined(const void *Object) const
+{
+  return QuarantineCount_ != 0 && Quarantined_.Has(Object);
+}
+
+/******************************************************************************/
+/*!
+  \brief
+    The constructor for the AddressSet class
+*/
+/******************************************************************************/
+ObjectAllocator::AddressSet::AddressSet()
+ :Count_(0), Bits_(0)
+{
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function makes room for Count addresses (the table is kept 
+   at most half full) and puts the addresses already in the set back
+
+  \param Count
+   number of addresses to make room for
+*/
+/******************************************************************************/
+void ObjectAllocator::AddressSet::Reserve(size_t Count)
+{
+  size_t Size = 8;
+  unsigned Bits = 3;
+  while(Size < 2 * Count)
+  {
+    Size <<= 1;
+    Bits++;
+  }
+  if(Size <= Slots_.size())
+  {
+    return;
+  }
+  std::vector<const void*> Old;
+  Old.swap(Slots_);
+  Slots_.assign(Size, static_cast<const void*>(NULL));
+  Bits_ = Bits;
+  Count_ = 0;
+  for(size_t i = 0; i < Old.size(); i++)
+  {
+    if(Old[i] != NULL)
+      Insert(Old[i]);
+  }
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function adds an address that is not in the set yet
+
+  \param Address
+   the address
+*/
+/******************************************************************************/
+void ObjectAllocator::AddressSet::Insert(const void *Address)
+{
+  if(2 * (Count_ + 1) > Slots_.size())
+  {
+    Reserve(Slots_.size() > Count_ + 1 ? Slots_.size() : Count_ + 1);
+  }
+  size_t Mask = Slots_.size() - 1;
+  size_t i = Home(Address);
+  while(Slots_[i] != NULL)
+    i = (i + 1) & Mask;
+  Slots_[i] = Address;
+  Count_++;
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function removes an address. The entries after it in its 
+   run move back so lookups never need tombstones.
+
+  \param Address
+   the address
+*/
+/******************************************************************************/
+void ObjectAllocator::AddressSet::Erase(const void *Address)
+{
+  if(Slots_.empty())
+  {
+    return;
+  }
+  size_t Mask = Slots_.size() - 1;
+  size_t i = Home(Address);
+  while(Slots_[i] != Address)
+  {
+    if(Slots_[i] == NULL)
+      return;
+    i = (i + 1) & Mask;
+  }
+  Slots_[i] = NULL;
+  Count_--;
+  //close the hole: move back every entry that probed past it
+  size_t j = i;
+  for(;;)
+  {
+    j = (j + 1) & Mask;
+    if(Slots_[j] == NULL)
+      break;
+    size_t k = Home(Slots_[j]);
+    bool Stays = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+    if(!Stays)
     {
-      //update pointers
-      prevPageList = tempPageList;
-      tempPageList = tempPageList -> Next;
+      Slots_[i] = Slots_[j];
+      Slots_[j] = NULL;
+      i = j;
     }
   }
-  //return pages freed
-  return PagesFree;
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function tells if an address is in the set
+
+  \param Address
+   the address
+
+  \return
+   true if the address is in the set
+*/
+/******************************************************************************/
+bool ObjectAllocator::AddressSet::Has(const void *Address) const
+{
+  if(Slots_.empty())
+  {
+    return false;
+  }
+  size_t Mask = Slots_.size() - 1;
+  for(size_t i = Home(Address); Slots_[i] != NULL; i = (i + 1) & Mask)
+  {
+    if(Slots_[i] == Address)
+      return true;
+  }
+  return false;
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function returns where an address starts probing 
+   (Fibonacci hashing, so aligned addresses still spread out)
+
+  \param Address
+   the address
+
+  \return
+   index in the table
+*/
+/******************************************************************************/
+size_t ObjectAllocator::AddressSet::Home(const void *Address) const
+{
+  unsigned long long Key = re_cast<uintptr_t>(Address);
+  return static_cast<size_t>((Key * 0x9E3779B97F4A7C15ULL) >> (64 - Bits_));
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function tells if every byte of a block holds a pattern. 
+   It compares a word at a time and ORs the differences together without 
+   branching, so the compiler can vectorize the loop.
+
+  \param Object
+   the block
+
+  \param Pattern
+   the expected byte
+
+  \return
+   true if the whole block holds the pattern
+*/
+/******************************************************************************/
+bool ObjectAllocator::Has_Pattern(const void *Object, unsigned char Pattern) const
+{
+  const unsigned char *Bytes = re_cast<const unsigned char*>(Object);
+  const unsigned long long Word = 0x0101010101010101ULL * Pattern;
+  unsigned long long Diff = 0;
+  size_t i = 0;
+  for(; i + sizeof(Word) <= _Stats.ObjectSize_; i += sizeof(Word))
+  {
+    unsigned long long Chunk;
+    memcpy(&Chunk, Bytes + i, sizeof(Chunk));
+    Diff |= Chunk ^ Word;
+  }
+  for(; i < _Stats.ObjectSize_; i++)
+  {
+    Diff |= Bytes[i] ^ Pattern;
+  }
+  return Diff == 0;
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function counts a request to free memory from a thread 
+   other than the owner. Each thread bumps its own cache line; GetStats adds 
+   them up. The owner counts its own frees in _Stats.
+*/
+/******************************************************************************/
+void ObjectAllocator::Count_Deallocation()
+{
+  static std::atomic<unsigned> NextThread(0);
+  thread_local unsigned Thread = NextThread.fetch_add(1, std::memory_order_relaxed);
+  StatShards_[Thread % StatShards_.size()].Count.fetch_add(1, std::memory_order_relaxed);
 }
 
 /******************************************************************************/
@@ -651,5 +2292,213 @@ OAConfig ObjectAllocator::GetConfig() const
 /******************************************************************************/
 OAStats ObjectAllocator::GetStats() const 
 {
-  return _Stats;  // returns the statistics for the allocator
+  OAStats Stats = _Stats;
+  //add up the shards
+  for(size_t i = 0; i < StatShards_.size(); i++)
+  {
+    Stats.Deallocations_ += StatShards_[i].Count.load(std::memory_order_relaxed);
+  }
+  return Stats;  // returns the statistics for the allocator
+}
+
+/******************************************************************************/
+/*!
+  \brief
+    The constructor for the PageProvider class
+
+  \param PageSize
+   size of every page handed out
+
+  \param MaxPages
+   most pages the provider may hold, idle or handed out (0 = unlimited)
+*/
+/******************************************************************************/
+PageProvider::PageProvider(size_t PageSize, unsigned MaxPages)
+ :PageSize_(PageSize), MaxPages_(MaxPages), PagesInUse_(0), IdleCount_(0), Idle_(NULL)
+{
+  if(PageSize_ < sizeof(GenericObject))
+  {
+    PageSize_ = sizeof(GenericObject);
+  }
+  //power-of-two pages are aligned to their size (for aligned-page allocators)
+  Aligned_ = (PageSize_ & (PageSize_ - 1)) == 0;
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The destructor for the PageProvider class. Every allocator using the 
+   provider must be destroyed first.
+*/
+/******************************************************************************/
+PageProvider::~PageProvider()
+{
+  Trim(0);
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function hands out a page, reusing an idle one if it can. 
+   The reason for a failure is reported under the same lock, so it holds 
+   even while other threads acquire and release.
+
+  \param OverBudget
+   if not NULL, set to true when the budget is used up, false otherwise
+
+  \return
+   the page (NULL if the budget is used up or there is no system memory)
+*/
+/******************************************************************************/
+void *PageProvider::Acquire(bool *OverBudget)
+{
+  std::lock_guard<std::mutex> Guard(Lock_);
+  if(OverBudget)
+  {
+    *OverBudget = false;
+  }
+  if(Idle_ != NULL)
+  {
+    GenericObject *Page = Idle_;
+    Idle_ = Idle_ -> Next;
+    IdleCount_--;
+    PagesInUse_++;
+    return Page;
+  }
+  if(MaxPages_ != 0 && PagesInUse_ >= MaxPages_)
+  {
+    if(OverBudget)
+    {
+      *OverBudget = true;
+    }
+    return NULL;
+  }
+  void *Page = NULL;
+#ifdef _WIN32
+  Page = Aligned_ ? _aligned_malloc(PageSize_, PageSize_) : malloc(PageSize_);
+#else
+  if(Aligned_)
+  {
+    if(posix_memalign(&Page, PageSize_, PageSize_) != 0)
+      Page = NULL;
+  }
+  else
+    Page = malloc(PageSize_);
+#endif
+  if(Page != NULL)
+  {
+    PagesInUse_++;
+  }
+  return Page;
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function takes a page back and keeps it for reuse
+
+  \param Page
+   a page from Acquire
+*/
+/******************************************************************************/
+void PageProvider::Release(void *Page)
+{
+  std::lock_guard<std::mutex> Guard(Lock_);
+  re_cast<GenericObject*>(Page) -> Next = Idle_;
+  Idle_ = re_cast<GenericObject*>(Page);
+  IdleCount_++;
+  PagesInUse_--;
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function gives idle pages back to the system
+
+  \param Keep
+   number of idle pages to keep
+
+  \return
+   number of pages freed
+*/
+/******************************************************************************/
+unsigned PageProvider::Trim(unsigned Keep)
+{
+  std::lock_guard<std::mutex> Guard(Lock_);
+  unsigned PagesFree = 0;
+  while(IdleCount_ > Keep)
+  {
+    GenericObject *Page = Idle_;
+    Idle_ = Idle_ -> Next;
+    IdleCount_--;
+#ifdef _WIN32
+    if(Aligned_)
+      _aligned_free(Page);
+    else
+      free(Page);
+#else
+    free(Page);
+#endif
+    PagesFree++;
+  }
+  return PagesFree;
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function tells if every page of the budget is handed out
+
+  \return
+   true if Acquire can only fail
+*/
+/******************************************************************************/
+bool PageProvider::AtBudget() const
+{
+  std::lock_guard<std::mutex> Guard(Lock_);
+  return Idle_ == NULL && MaxPages_ != 0 && PagesInUse_ >= MaxPages_;
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function returns the size of the pages
+
+  \return
+   the page size
+*/
+/******************************************************************************/
+size_t PageProvider::GetPageSize() const
+{
+  return PageSize_;
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function returns the number of pages handed out
+
+  \return
+   pages in use by allocators
+*/
+/******************************************************************************/
+unsigned PageProvider::GetPagesInUse() const
+{
+  std::lock_guard<std::mutex> Guard(Lock_);
+  return PagesInUse_;
+}
+
+/******************************************************************************/
+/*!
+  \brief
+   The following function returns the number of idle pages
+
+  \return
+   pages kept for reuse
+*/
+/******************************************************************************/
+unsigned PageProvider::GetIdlePages() const
+{
+  std::lock_guard<std::mutex> Guard(Lock_);
+  return IdleCount_;
 }
\ No newline at end of file
@@ -4,10 +4,27 @@
 //---------------------------------------------------------------------------
 
 #include <string>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include <mutex>
+
+// AllocateAsync needs C++20 coroutines
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#define OA_COROUTINES
+#endif
+#endif
 
 // If the client doesn't specify these:
 static const int DEFAULT_OBJECTS_PER_PAGE = 4;  
 static const int DEFAULT_MAX_PAGES = 3;
+static const int DEFAULT_STAT_SHARDS = 8; // when remote frees are on
+static const unsigned CACHE_LINE_SIZE = 64; // split-header payloads start on one
+static const unsigned TRIM_BATCH = 8; // auto-trim once extra empty pages hold 1/N of the free blocks
 
 /*!
   Exception class
@@ -69,12 +86,14 @@ class OAException
 };
 
 
+class PageProvider;
+
 /*!
   ObjectAllocator configuration parameters
 */
 struct OAConfig
 {
-  static const size_t BASIC_HEADER_SIZE = sizeof(unsigned) + 1; //!< allocation number + flags
+  static const size_t BASIC_HEADER_SIZE = sizeof(unsigned long long) + 1; //!< allocation number + flags
   static const size_t EXTERNAL_HEADER_SIZE = sizeof(void*);     //!< just a pointer
 
   /*!
@@ -106,12 +125,39 @@ struct OAConfig
       if (type_ == hbBasic)
         size_ = BASIC_HEADER_SIZE;
       else if (type_ == hbExtended) // alloc # + use counter + flag byte + user-defined
-        size_ = sizeof(unsigned int) + sizeof(unsigned short) + sizeof(char) + additional_;
+        size_ = sizeof(unsigned long long) + sizeof(unsigned short) + sizeof(char) + additional_;
       else if (type_ == hbExternal)
         size_ = EXTERNAL_HEADER_SIZE;
     };
   };
 
+  /*!
+    POD that stores when empty pages are given back to the system.
+  */
+  struct TrimPolicyInfo
+  {
+    bool AutoTrim_;       //!< Trim from Free once more than SparePages_ pages are empty
+    unsigned SparePages_; //!< How many empty pages to keep for reuse
+    double EmptySeconds_; //!< How long a page must stay empty before it is freed (0=at once)
+
+    /*!
+      Constructor
+
+      \param AutoTrim
+        Whether Free trims by itself when more pages than SparePages are empty.
+
+      \param SparePages
+        The number of empty pages that are never given back by a trim.
+
+      \param EmptySeconds
+        The minimum time a page has to be empty before a trim frees it.
+    */
+    TrimPolicyInfo(bool AutoTrim = false, unsigned SparePages = 0, double EmptySeconds = 0.0)
+      : AutoTrim_(AutoTrim), SparePages_(SparePages), EmptySeconds_(EmptySeconds)
+    {
+    };
+  };
+
   /*!
     Constructor
 
@@ -155,6 +201,15 @@ struct OAConfig
     HBlockInfo_ = HBInfo;
     LeftAlignSize_ = 0;  
     InterAlignSize_ = 0;
+    DebugSampleRate_ = 0;
+    GuardPages_ = false;
+    QuarantineSize_ = 0;
+    StatShards_ = 0;
+    RemoteFree_ = false;
+    AlignedPages_ = false;
+    Provider_ = NULL;
+    SoftMaxPages_ = 0;
+    SplitHeaders_ = false;
   }
 
   bool UseCPPMemManager_;      //!< by-pass the functionality of the OA and use new/delete
@@ -166,6 +221,16 @@ struct OAConfig
   unsigned Alignment_;         //!< address alignment of each block
   unsigned LeftAlignSize_;     //!< number of alignment bytes required to align first block
   unsigned InterAlignSize_;    //!< number of alignment bytes required between remaining blocks
+  TrimPolicyInfo TrimPolicy_;  //!< when Trim gives empty pages back (FreeEmptyPages ignores it)
+  unsigned DebugSampleRate_;   //!< debugging code runs on 1 in N blocks (0 or 1=every block)
+  bool GuardPages_;            //!< end each page on an inaccessible (PROT_NONE) guard page
+  unsigned QuarantineSize_;    //!< freed (signed) blocks held back before reuse (0=none)
+  unsigned StatShards_;        //!< per-thread slots counting frees from other threads (RemoteFree_ only, 0=DEFAULT_STAT_SHARDS)
+  bool RemoteFree_;            //!< frees from other threads are queued for the owner and counted in StatShards_
+  bool AlignedPages_;          //!< power-of-two block stride, pages aligned to their power-of-two size (no guard pages)
+  PageProvider *Provider_;     //!< shared source of pages, its budget replaces MaxPages_ (NULL=own pages)
+  unsigned SoftMaxPages_;      //!< pages past which Allocate asks for memory back before growing (0=none)
+  bool SplitHeaders_;          //!< headers in a metadata array at the page start, payloads never straddle a cache line
 };
 
 
@@ -185,9 +250,9 @@ struct OAStats
   unsigned FreeObjects_;   //!< number of objects on the free list
   unsigned ObjectsInUse_;  //!< number of objects in use by client
   unsigned PagesInUse_;    //!< number of pages allocated
-  unsigned MostObjects_;   //!< most objects in use by client at one time
-  unsigned Allocations_;   //!< total requests to allocate memory
-  unsigned Deallocations_; //!< total requests to free memory
+  unsigned long long MostObjects_;   //!< most objects in use by client at one time
+  unsigned long long Allocations_;   //!< total requests to allocate memory
+  unsigned long long Deallocations_; //!< total requests to free memory
 };
 
 /*!
@@ -205,7 +270,52 @@ struct MemBlockInfo
 {
   bool in_use;        //!< Is the block free or in use?
   char *label;        //!< A dynamically allocated NUL-terminated string
-  unsigned alloc_num; //!< The allocation number (count) of this block
+  unsigned long long alloc_num; //!< The allocation number (count) of this block
+};
+
+/*!
+  This class hands out fixed-size raw pages to many ObjectAllocators (one 
+  per object type, say) and keeps the pages they give back for reuse, so 
+  idle memory moves between them. One memory budget covers all of them. 
+  It is thread-safe and must outlive the allocators using it.
+*/
+class PageProvider
+{
+  public:
+      // Pages of PageSize bytes (power-of-two sizes are aligned to their size), at most
+      // MaxPages of them idle or handed out (0=unlimited)
+    PageProvider(size_t PageSize, unsigned MaxPages = 0);
+
+      // Frees the idle pages
+    ~PageProvider();
+
+      // Hands out a page, NULL if the budget is used up or the system has no memory.
+      // OverBudget (if given) tells which: AtBudget may have changed by the time it is asked
+    void *Acquire(bool *OverBudget = NULL);
+
+      // Takes a page back for reuse
+    void Release(void *Page);
+
+      // Gives idle pages back to the system, keeping Keep of them. Returns pages freed
+    unsigned Trim(unsigned Keep = 0);
+
+    bool AtBudget() const;           // true if Acquire can only fail
+    size_t GetPageSize() const;      // returns the size of the pages
+    unsigned GetPagesInUse() const;  // returns the pages handed out
+    unsigned GetIdlePages() const;   // returns the pages kept for reuse
+
+      // Prevent copy construction and assignment
+    PageProvider(const PageProvider &pp) = delete;            //!< Do not implement!
+    PageProvider &operator=(const PageProvider &pp) = delete; //!< Do not implement!
+
+  private:
+    size_t PageSize_;       //!< size of every page
+    unsigned MaxPages_;     //!< budget (0=unlimited)
+    unsigned PagesInUse_;   //!< pages handed out
+    unsigned IdleCount_;    //!< pages kept for reuse
+    GenericObject *Idle_;   //!< the pages kept for reuse
+    bool Aligned_;          //!< pages are aligned to their size
+    mutable std::mutex Lock_;
 };
 
 /*!
@@ -217,6 +327,17 @@ class ObjectAllocator
       // Defined by the client (pointer to a block, size of block)
     typedef void (*DUMPCALLBACK)(const void *, size_t);     //!< Callback function when dumping memory leaks
     typedef void (*VALIDATECALLBACK)(const void *, size_t); //!< Callback function when validating blocks
+      // Defined by the client (old block, new block, size of block), returns true once references are updated
+    typedef bool (*RELOCATECALLBACK)(const void *, void *, size_t); //!< Callback function when compacting pages
+    typedef void (*QUARANTINECALLBACK)(const void *, size_t); //!< Callback function for a block written after Free
+
+      // How short of pages the allocator is
+    enum PRESSURE_LEVEL 
+    {
+      plSoft, //!< past SoftMaxPages_, about to grow
+      plHard  //!< at MaxPages_ (or the provider budget), about to fail
+    };
+    typedef void (*PRESSURECALLBACK)(ObjectAllocator &, PRESSURE_LEVEL); //!< Callback function when short of pages
 
       // Predefined values for memory signatures
     static const unsigned char UNALLOCATED_PATTERN = 0xAA; //!< New memory never given to the client
@@ -236,6 +357,49 @@ class ObjectAllocator
       // Throws an exception if the object can't be allocated. (Memory allocation problem)
     void *Allocate(const char *label = 0);
 
+      // Same as Allocate, but returns NULL instead of throwing when out of pages/memory.
+      // Debug errors of remote frees it drains are kept for DrainRemoteFrees. Only an
+      // exception thrown by the pressure handler passes through.
+    void *TryAllocate(const char *label = 0);
+
+      // Called before growing past SoftMaxPages_ and before failing at the hard limit
+    void SetPressureCallback(PRESSURECALLBACK fn);
+
+      // Awaitable returned by AllocateAsync
+    class AllocateAwaiter;
+#ifdef OA_COROUTINES
+    /*!
+      co_await gives a block. When the allocator is out of pages the coroutine
+      waits in FIFO order until a Free, DrainRemoteFrees or FlushQuarantine on
+      the owner thread frees a block (or a page) for it.
+      With a shared PageProvider, pages another allocator gives back to the
+      provider do not wake these waiters: the provider does not know them, and
+      its Release may run on another thread while waiters resume on the owner.
+      Call DrainRemoteFrees on the owner thread after siblings free pages; it
+      refills from the provider for the waiters.
+      Waiters still queued when the allocator is destroyed are never resumed.
+    */
+    class AllocateAwaiter
+    {
+      public:
+        AllocateAwaiter(ObjectAllocator &oa, const char *label);
+        bool await_ready();
+        void await_suspend(std::coroutine_handle<> Handle);
+        void *await_resume();
+
+      private:
+        friend class ObjectAllocator;
+        ObjectAllocator &OA_;            //!< the allocator
+        const char *Label_;              //!< label for the block
+        void *Block_;                    //!< the block, once there is one
+        std::coroutine_handle<> Handle_; //!< the waiting coroutine
+        AllocateAwaiter *Next_;          //!< next waiter in the queue
+    };
+
+      // Allocate for coroutines: suspends instead of failing when out of pages
+    AllocateAwaiter AllocateAsync(const char *label = 0);
+#endif
+
       // Returns an object to the free list for the client (simulates delete)
       // Throws an exception if the the object can't be freed. (Invalid object)
     void Free(void *Object);
@@ -249,6 +413,37 @@ class ObjectAllocator
       // Frees all empty page
     unsigned FreeEmptyPages();
 
+      // Moves live blocks off the sparsest pages into holes on the densest ones, then
+      // frees the emptied pages. Stops after MaxMoves moves or MaxSeconds (0=no limit).
+      // The callback must not call Allocate/Free on this allocator. If it throws, the
+      // moves made so far stand and the exception is passed on. Returns blocks moved.
+    unsigned Compact(RELOCATECALLBACK fn, unsigned MaxMoves = 0, double MaxSeconds = 0.0);
+
+      // Frees the empty pages the trim policy allows (keeps the spare pages and the
+      // pages that have not been empty long enough). With AutoTrim_ on, Free and
+      // Allocate call it once the empty pages beyond SparePages_ hold 1/TRIM_BATCH of
+      // the free blocks (and one held back is old enough); a maintenance timer/thread
+      // can call it too (under the client's lock).
+    unsigned Trim();
+
+      // Freed blocks wait in a FIFO quarantine (OAConfig::QuarantineSize_) before they
+      // go back on the free list. A block whose FREED_PATTERN changed in the meantime
+      // is reported to the callback when it leaves. Quarantined blocks are not counted
+      // in FreeObjects_. Flush returns the number of blocks released.
+    unsigned FlushQuarantine();
+    void SetQuarantineCallback(QUARANTINECALLBACK fn);
+
+      // With OAConfig::RemoteFree_, Free from a thread other than the owner pushes
+      // the block on a lock-free list; the owner takes the list back in one go when
+      // Allocate runs out of blocks (or Drain is called). Only the owner allocates.
+      // Queued blocks still count as in use. With UseCPPMemManager_ they are queued
+      // too and the owner's next Allocate frees them. Drain returns the blocks taken back.
+      // The debug errors a drain finds (double or bad frees) are thrown by Drain or
+      // by an Allocate that drains; TryAllocate, Trim, FreeEmptyPages, Compact and
+      // the wait queue keep the first one for those instead of throwing it.
+    void SetOwnerThread(void);
+    unsigned DrainRemoteFrees();
+
       // Testing/Debugging/Statistic methods
     void SetDebugState(bool State);   // true=enable, false=disable
     const void *GetFreeList() const;  // returns a pointer to the internal free list
@@ -269,8 +464,115 @@ class ObjectAllocator
 		OAConfig _Config; //configuration parameters
 		OAStats _Stats;
 
+      // One cache line per slot so threads freeing remotely don't share a line. Only
+      // their Deallocations_ is sharded: every other counter (and the owner's frees)
+      // is only touched by the owner, so it stays in _Stats. Without RemoteFree_ the
+      // allocator is single-threaded and there are no shards.
+    struct alignas(CACHE_LINE_SIZE) StatShard
+    {
+      std::atomic<unsigned long long> Count;
+      StatShard() : Count(0) {}
+    };
+    std::vector<StatShard> StatShards_;
+    void Count_Deallocation(void);
+
+    std::thread::id Owner_;                    // the thread that allocates
+    std::atomic<GenericObject*> RemoteFrees_;  // blocks freed by other threads
+    void Free_Block(void *Object);
+    void Push_Remote(void *Object);
+    unsigned Drain_Remote(bool Throw);
+    bool RemoteFailed_;                        // a drain that could not throw found an error
+    OAException::OA_EXCEPTION RemoteCode_;     // its code
+    std::string RemoteMessage_;                // and message
+    void *Allocate_Block(const char *label, bool Throw);
+
     size_t midBlockSize;
     void *Create_NewPage(void);
+    void *Alloc_PageMemory(bool *OverBudget);
+    void Free_PageMemory(void *Page);
+    bool Is_Sampled(const void *Object) const;
+    bool At_PageLimit(void) const;
+    bool Refill_FreeList(bool Throw);
+    char *First_Block(GenericObject *Page) const;
+    char *Header_Of(void *Object) const;
+    size_t Slot_Of(GenericObject *Page, const void *Object) const;
+    void Release_Page(GenericObject *Page, GenericObject *Prev);
+
+      // Free blocks of one page
+    struct PageTally
+    {
+      GenericObject *Page;        // the page
+      unsigned FreeCount;         // blocks of the page on the free list
+      std::vector<char> FreeSlot; // which slots are on the free list
+      bool Release;               // page is about to be freed
+    };
+    void Tally_Pages(std::vector<PageTally> &Pages) const;
+    static PageTally &Tally_Of(std::vector<PageTally> &Pages, const void *Address);
+    void Relink_FreeList(std::vector<PageTally> &Pages);
+    unsigned Release_EmptyPages(unsigned Keep, double MinSeconds);
+    void Push_Free(void *Object);
+    void Quarantine_Block(void *Object);
+    void Release_Quarantined(void);
+    bool Is_Quarantined(const void *Object) const;
+    bool Has_Pattern(const void *Object, unsigned char Pattern) const;
+
+    typedef std::chrono::steady_clock::time_point TimePoint;
+      // Free blocks of one page and when it became empty (kept with AutoTrim_ or EmptySeconds_)
+    struct PageClock
+    {
+      GenericObject *Page;  // the page
+      unsigned FreeCount;   // blocks of the page on the free list
+      TimePoint EmptySince; // when the last of them came back
+      bool Release;         // page is about to be freed
+    };
+    std::vector<PageClock> Clocks_; // sorted by page address
+    void Start_Clock(GenericObject *Page);
+    PageClock &Clock_Of(const void *Address);
+    bool Trim_Due(void) const;
+    unsigned Release_TrackedPages(unsigned Keep, double MinSeconds);
+    unsigned EmptyPages_;    // tracked pages with all their blocks on the free list
+    TimePoint TrimAt_;       // when a held back empty page is old enough (epoch=none)
+
+    size_t GuardMapSize_;    // bytes mapped for a guarded page, guard included
+    size_t GuardSize_;       // bytes of the guard (one OS page)
+    size_t GuardOffset_;     // where the page starts in its mapping
+
+      // Open-addressed set of addresses (linear probing), no allocation while under half full
+    class AddressSet
+    {
+      public:
+        AddressSet();
+        void Reserve(size_t Count);
+        void Insert(const void *Address);
+        void Erase(const void *Address);
+        bool Has(const void *Address) const;
+
+      private:
+        size_t Home(const void *Address) const;
+        std::vector<const void*> Slots_; // power-of-two table, NULL=empty
+        size_t Count_;
+        unsigned Bits_;                  // log2 of the table size
+    };
+
+    std::vector<GenericObject*> Quarantine_; // ring of freed blocks, oldest at QuarantineHead_
+    AddressSet Quarantined_;                 // the same blocks, for lookups
+    size_t QuarantineHead_;
+    size_t QuarantineCount_;
+    QUARANTINECALLBACK QuarantineFn_;
+
+    size_t PageSpan_;        // bytes of an aligned page (power of two)
+    uintptr_t PageMask_;     // block address & mask = its aligned page
+    unsigned BlockShift_;    // log2 of the aligned block stride
+    AddressSet PageSet_;     // the aligned pages, so Free checks a masked page at once
+
+    PRESSURECALLBACK PressureFn_;
+
+    AllocateAwaiter *WaitHead_; // oldest coroutine waiting for a block
+    AllocateAwaiter *WaitTail_; // newest one
+    void Serve_Waiters(void);
+
+    size_t MetaSize_;    // bytes of the header array of a split-header page
+    size_t BlockHeader_; // header bytes inside each block (0 with split headers)
 };
 
 #endif
@@ -0,0 +1,836 @@
+/******************************************************************************/
+/*!
+\file   oa_stress.cpp
+\brief
+    Randomized stress test for the ObjectAllocator. Every run builds an
+    allocator from a random configuration (header type, pads, alignment,
+    debug state and the optional modes: trim policy, sampling, guard pages,
+    quarantine, stat shards, remote frees, aligned pages, page provider,
+    pressure callback, split headers) and drives it with a random mix of
+    Allocate/TryAllocate/AllocateAsync/Free/Compact/Trim/... against a
+    shadow model of the blocks the client owns. After every step OAStats,
+    DumpMemoryInUse and ValidatePages must agree with the model, and the
+    debug checks must catch the double frees, bad pointers and overwrites
+    the test makes on purpose.
+
+    The bytes that drive a run come from libFuzzer (LLVMFuzzerTestOneInput,
+    built with OA_LIBFUZZER) or from a seeded generator (main, the argument
+    is the number of seeds). Build it with -fsanitize=address,undefined
+    (see CMakeLists.txt).
+*/
+/******************************************************************************/
+
+#include "ObjectAllocator.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <vector>
+#include <memory>
+#include <random>
+#include <thread>
+#include <unistd.h>
+
+#define CHECK(c) do { if(!(c)) Fail(#c, __LINE__); } while(0)
+
+namespace
+{
+  const unsigned MAX_STEPS = 1000;  //!< operations per run
+  const unsigned MAX_WAITERS = 4;   //!< AllocateAsync coroutines waiting at once
+  const unsigned FULL_CHECK = 8;    //!< large allocators are dumped every N steps
+
+  /*!
+    Hands out the bytes that drive a run as small numbers. Once the bytes
+    run out every number is 0 and the run stops.
+  */
+  class Input
+  {
+    public:
+      Input(const uint8_t *Data, size_t Size) : Data_(Data), Size_(Size), Pos_(0) {}
+
+        // Returns a number in [0, Range)
+      unsigned Take(unsigned Range)
+      {
+        unsigned Value = 0;
+        for(int i = 0; i < 2 && Pos_ < Size_; i++)
+          Value = (Value << 8) | Data_[Pos_++];
+        return Range ? Value % Range : 0;
+      }
+      bool Done() const { return Pos_ >= Size_; }
+
+    private:
+      const uint8_t *Data_;
+      size_t Size_;
+      size_t Pos_;
+  };
+
+  /*!
+    One run: the allocators and the shadow model of the client's blocks
+  */
+  struct Harness
+  {
+    Harness(Input &In) : In_(In), ObjectSize_(0), Checked_(false), Limited_(false), PageSize_(0),
+      Allocs_(0), Deallocs_(0), Most_(0), Waiting_(0), Fill_(0), Step_(0) {}
+
+    void Setup();
+    void Run();
+    void Finish();
+
+    void Took(void *Block);
+    void FreeLocal(void *Block);
+    void *PickLive();
+    void Verify();
+
+    void OpAllocate();
+    void OpFree();
+    void OpRemoteFree();
+    void OpSibling();
+    void OpDoubleFree();
+    void OpBadBoundary();
+    void OpCorruptPad();
+    void OpWriteAfterFree();
+#ifdef OA_COROUTINES
+    void OpAllocateAsync();
+#endif
+
+    Input &In_;
+    OAConfig Config_;
+    size_t ObjectSize_;
+    bool Checked_;     // every Free is checked (debug on, no sampling, no CPP)
+    bool Limited_;     // MaxPages_ or a provider budget may run out
+    size_t PageSize_;
+
+    std::unique_ptr<PageProvider> Provider_;   // declared first, outlives the allocators
+    std::unique_ptr<ObjectAllocator> OA_;
+    std::unique_ptr<ObjectAllocator> Sibling_; // shares the provider
+    std::vector<void*> SiblingBlocks_;
+
+    std::map<void*, unsigned char> Live_; // client blocks and the byte they are filled with
+    std::set<void*> Pending_;             // freed by another thread, maybe not drained yet
+    std::set<const void*> Seen_;          // blocks reported by a callback
+    unsigned long long Allocs_;
+    unsigned long long Deallocs_;
+    size_t Most_;
+    unsigned Waiting_;
+    unsigned char Fill_;
+    unsigned Step_;
+    char Name_[256];
+  };
+
+  Harness *Current = NULL; //!< the run the (plain function) callbacks belong to
+
+  /****************************************************************************/
+  /*!
+    \brief
+     Reports a failed check with the configuration and the step, then aborts
+     so the fuzzer (or ctest) sees a crash
+
+    \param What
+     the failed condition
+
+    \param Line
+     where it is
+  */
+  /****************************************************************************/
+  void Fail(const char *What, int Line)
+  {
+    if(Current)
+      fprintf(stderr, "FAILED: %s (line %d) %s step %u\n", What, Line, Current -> Name_, Current -> Step_);
+    else
+      fprintf(stderr, "FAILED: %s (line %d)\n", What, Line);
+    abort();
+  }
+
+  /****************************************************************************/
+  /*!
+    \brief
+     Counts the nodes of the free list or the page list
+  */
+  /****************************************************************************/
+  unsigned CountList(const void *List)
+  {
+    unsigned Count = 0;
+    for(const GenericObject *Node = static_cast<const GenericObject*>(List); Node; Node = Node -> Next)
+      Count++;
+    return Count;
+  }
+
+  /****************************************************************************/
+  /*!
+    \brief
+     Dump/validate/quarantine callback: remembers the blocks reported
+  */
+  /****************************************************************************/
+  void Record(const void *Block, size_t)
+  {
+    Current -> Seen_.insert(Block);
+  }
+
+  /****************************************************************************/
+  /*!
+    \brief
+     Compact callback: the client's reference follows the block, or the
+     move is refused, or the callback throws (Compact must leave the
+     allocator usable)
+  */
+  /****************************************************************************/
+  struct RelocateFailed {};
+
+  bool Relocate(const void *From, void *To, size_t Size)
+  {
+    Harness &H = *Current;
+    std::map<void*, unsigned char>::iterator It = H.Live_.find(const_cast<void*>(From));
+    CHECK(It != H.Live_.end());
+    CHECK(memcmp(From, To, Size) == 0);
+    if(H.In_.Take(32) == 0)
+      throw RelocateFailed();
+    if(H.In_.Take(8) == 0)
+      return false;
+    unsigned char Fill = It -> second;
+    H.Live_.erase(It);
+    H.Live_[To] = Fill;
+    return true;
+  }
+
+  /****************************************************************************/
+  /*!
+    \brief
+     Pressure callback: gives memory back the ways the handler may
+  */
+  /****************************************************************************/
+  void Pressure(ObjectAllocator &OA, ObjectAllocator::PRESSURE_LEVEL Level)
+  {
+    Harness &H = *Current;
+    CHECK(&OA == H.OA_.get());
+    CHECK(Level == ObjectAllocator::plHard || H.Config_.SoftMaxPages_ != 0);
+    switch(H.In_.Take(4))
+    {
+      case 0:
+        if(!H.Live_.empty())
+          H.FreeLocal(H.PickLive());
+        break;
+      case 1:
+        OA.FreeEmptyPages();
+        break;
+      case 2:
+        OA.Trim();
+        break;
+      default:
+        break;
+    }
+  }
+
+#ifdef OA_COROUTINES
+  /*!
+    Coroutine that runs to completion on its own (frame freed at the end)
+  */
+  struct Detached
+  {
+    struct promise_type
+    {
+      Detached get_return_object() { return Detached(); }
+      std::suspend_never initial_suspend() { return std::suspend_never(); }
+      std::suspend_never final_suspend() noexcept { return std::suspend_never(); }
+      void return_void() {}
+      void unhandled_exception() { abort(); }
+    };
+  };
+
+  /****************************************************************************/
+  /*!
+    \brief
+     Waits for a block and hands it to the client
+  */
+  /****************************************************************************/
+  Detached WaitForBlock(Harness &H)
+  {
+    H.Waiting_++;
+    void *Block = co_await H.OA_ -> AllocateAsync("async");
+    H.Waiting_--;
+    H.Took(Block);
+  }
+#endif
+
+  /****************************************************************************/
+  /*!
+    \brief
+     Builds the configuration and the allocators from the input
+  */
+  /****************************************************************************/
+  void Harness::Setup()
+  {
+    static const unsigned Alignments[] = {0, 0, 4, 8, 16, 7, 64};
+    bool CPP = In_.Take(10) == 0;
+    unsigned PerPage = 1 + In_.Take(9);
+    unsigned MaxPages = In_.Take(2) ? 0 : 2 + In_.Take(20);
+    bool Debug = In_.Take(3) != 0;
+    unsigned Pad = In_.Take(3) * In_.Take(5);
+    OAConfig::HBLOCK_TYPE Type = static_cast<OAConfig::HBLOCK_TYPE>(In_.Take(4));
+    unsigned Additional = In_.Take(4);
+    unsigned Alignment = Alignments[In_.Take(7)];
+    ObjectSize_ = sizeof(void*) + In_.Take(60);
+
+    Config_ = OAConfig(CPP, PerPage, MaxPages, Debug, Pad, OAConfig::HeaderBlockInfo(Type, Additional), Alignment);
+    Config_.DebugSampleRate_ = In_.Take(4) == 0 ? 2 + In_.Take(3) : In_.Take(2);
+    Config_.QuarantineSize_ = In_.Take(4) == 0 ? 1 + In_.Take(6) : 0;
+    if(In_.Take(3) == 0)
+    {
+      bool Auto = In_.Take(4) != 0;
+      unsigned Spare = In_.Take(3);
+      Config_.TrimPolicy_ = OAConfig::TrimPolicyInfo(Auto, Spare, In_.Take(2) ? 0.0 : 0.0005);
+    }
+    switch(In_.Take(8))
+    {
+      case 0: Config_.AlignedPages_ = true; break;
+      case 1: Config_.GuardPages_ = true; break;
+      case 2: Config_.SplitHeaders_ = true; break;
+      case 3: Config_.SplitHeaders_ = Config_.AlignedPages_ = true; break;
+      default: break;
+    }
+    Config_.StatShards_ = In_.Take(4) == 0 ? 1 + In_.Take(4) : 0;
+    Config_.RemoteFree_ = In_.Take(5) == 0;
+    Config_.SoftMaxPages_ = In_.Take(4) == 0 ? 1 + In_.Take(5) : 0;
+    bool Shared = !CPP && In_.Take(5) == 0;
+    unsigned Budget = In_.Take(2) ? 0 : 2 + In_.Take(20);
+    bool Handler = In_.Take(2) != 0;
+
+    Checked_ = Debug && !CPP && Config_.DebugSampleRate_ <= 1;
+    Limited_ = Shared ? Budget != 0 : MaxPages != 0;
+
+    //pages of a provider hold a whole (aligned) page of the allocators
+    if(Shared)
+    {
+      ObjectAllocator Probe(ObjectSize_, Config_);
+      size_t Size = Probe.GetStats().PageSize_;
+      if(Config_.AlignedPages_ || Config_.SplitHeaders_)
+      {
+        size_t Span = sizeof(void*);
+        while(Span < Size)
+          Span <<= 1;
+        Size = Span;
+      }
+      Provider_.reset(new PageProvider(Size, Budget));
+      Config_.Provider_ = Provider_.get();
+    }
+
+    snprintf(Name_, sizeof(Name_), "cpp%d opp%u max%u dbg%d pad%u hb%d+%u al%u size%zu samp%u "
+      "quar%u trim%d/%u/%g ap%d gp%d split%d shards%u remote%d soft%u provider%d/%u handler%d",
+      CPP, PerPage, MaxPages, Debug, Pad, Type, Additional, Alignment, ObjectSize_,
+      Config_.DebugSampleRate_, Config_.QuarantineSize_, Config_.TrimPolicy_.AutoTrim_,
+      Config_.TrimPolicy_.SparePages_, Config_.TrimPolicy_.EmptySeconds_, Config_.AlignedPages_,
+      Config_.GuardPages_, Config_.SplitHeaders_, Config_.StatShards_, Config_.RemoteFree_,
+      Config_.SoftMaxPages_, Shared, Budget, Handler);
+
+    OA_.reset(new ObjectAllocator(ObjectSize_, Config_));
+    PageSize_ = OA_ -> GetStats().PageSize_;
+    if(Shared)
+      Sibling_.reset(new ObjectAllocator(ObjectSize_, Config_));
+    OA_ -> SetQuarantineCallback(Record);
+    if(Handler)
+      OA_ -> SetPressureCallback(Pressure);
+  }
+
+  /****************************************************************************/
+  /*!
+    \brief
+     Adds a block the client got to the model and fills it
+  */
+  /****************************************************************************/
+  void Harness::Took(void *Block)
+  {
+    CHECK(Block != NULL);
+    CHECK(Live_.count(Block) == 0);
+    uintptr_t Address = reinterpret_cast<uintptr_t>(Block);
+    unsigned Alignment = Config_.Alignment_;
+    bool PowerOfTwo = (Alignment & (Alignment - 1)) == 0;
+    if(!Config_.UseCPPMemManager_ && Alignment > 1 && PowerOfTwo &&
+      (Alignment <= 16 || Config_.AlignedPages_ || Config_.SplitHeaders_))
+    {
+      CHECK(Address % Alignment == 0);
+    }
+    if(!Config_.UseCPPMemManager_ && Config_.SplitHeaders_ && PowerOfTwo && ObjectSize_ <= CACHE_LINE_SIZE)
+    {
+      CHECK(Address / CACHE_LINE_SIZE == (Address + ObjectSize_ - 1) / CACHE_LINE_SIZE);
+    }
+    Pending_.erase(Block);
+    Fill_ = static_cast<unsigned char>(Fill_ * 7 + 13);
+    memset(Block, Fill_, ObjectSize_);
+    Live_[Block] = Fill_;
+    Allocs_++;
+    if(Live_.size() > Most_)
+      Most_ = Live_.size();
+  }
+
+  /****************************************************************************/
+  /*!
+    \brief
+     Takes a block out of the model (checking nobody wrote to it) and frees
+     it on this thread
+  */
+  /****************************************************************************/
+  void Harness::FreeLocal(void *Block)
+  {
+    std::map<void*, unsigned char>::iterator It = Live_.find(Block);
+    CHECK(It != Live_.end());
+    const unsigned char *Bytes = static_cast<const unsigned char*>(Block);
+    for(size_t i = 0; i < ObjectSize_; i++)
+      CHECK(Bytes[i] == It -> second);
+    Live_.erase(It);
+    Deallocs_++;
+    OA_ -> Free(Block);
+  }
+
+  /****************************************************************************/
+  /*!
+    \brief
+     Returns a random block of the client (there must be one)
+  */
+  /****************************************************************************/
+  void *Harness::PickLive()
+  {
+    std::map<void*, unsigned char>::iterator It = Live_.begin();
+    std::advance(It, In_.Take(static_cast<unsigned>(Live_.size())));
+    return It -> first;
+  }
+
+  /****************************************************************************/
+  /*!
+    \brief
+     Allocate or TryAllocate; only a page limit may stop them
+  */
+  /****************************************************************************/
+  void Harness::OpAllocate()
+  {
+    unsigned How = In_.Take(3);
+    void *Block = NULL;
+    try
+    {
+      if(How == 0)
+        Block = OA_ -> TryAllocate();
+      else
+        Block = OA_ -> Allocate(How == 1 ? "label" : NULL);
+    }
+    catch(OAException &e)
+    {
+      CHECK(e.code() == OAException::E_NO_PAGES);
+      CHECK(Limited_);
+      return;
+    }
+    if(Block == NULL)
+    {
+      CHECK(Limited_);
+      return;
+    }
+    Took(Block);
+  }
+
+  /****************************************************************************/
+  /*!
+    \brief
+     Frees a random block
+  */
+  /****************************************************************************/
+  void Harness::OpFree()
+  {
+    if(!Live_.empty())
+      FreeLocal(PickLive());
+  }
+
+  /****************************************************************************/
+  /*!
+    \brief
+     Frees a few blocks from another thread, then maybe drains them
+  */
+  /****************************************************************************/
+  void Harness::OpRemoteFree()
+  {
+    std::vector<void*> Batch;
+    unsigned Count = 1 + In_.Take(8);
+    while(Batch.size() < Count && !Live_.empty())
+    {
+      void *Block = PickLive();
+      const unsigned char *Bytes = static_cast<const unsigned char*>(Block);
+      for(size_t i = 0; i < ObjectSize_; i++)
+        CHECK(Bytes[i] == Live_[Block]);
+      Live_.erase(Block);
+      Pending_.insert(Block);
+      Batch.push_back(Block);
+      Deallocs_++;
+    }
+    ObjectAllocator *OA = OA_.get();
+    std::thread Remote([OA, &Batch]()
+    {
+      for(size_t i = 0; i < Batch.size(); i++)
+        OA -> Free(Batch[i]);
+    });
+    Remote.join();
+    if(In_.Take(2))
+    {
+      unsigned Drained = OA_ -> DrainRemoteFrees();
+      CHECK(Drained <= Pending_.size());
+      Pending_.clear();
+    }
+  }
+
+  /****************************************************************************/
+  /*!
+    \brief
+     Lets the allocator sharing the provider take or give back pages
+  */
+  /****************************************************************************/
+  void Harness::OpSibling()
+  {
+    switch(In_.Take(3))
+    {
+      case 0:
+      {
+        void *Block = Sibling_ -> TryAllocate();
+        if(Block)
+          SiblingBlocks_.push_back(Block);
+        else
+          CHECK(Limited_);
+        break;
+      }
+      case 1:
+        if(!SiblingBlocks_.empty())
+        {
+          size_t Pick = In_.Take(static_cast<unsigned>(SiblingBlocks_.size()));
+          Sibling_ -> Free(SiblingBlocks_[Pick]);
+          SiblingBlocks_[Pick] = SiblingBlocks_.back();
+          SiblingBlocks_.pop_back();
+        }
+        break;
+      default:
+        Sibling_ -> FreeEmptyPages();
+        break;
+    }
+  }
+
+  /****************************************************************************/
+  /*!
+    \brief
+     Frees a block twice, the second Free must throw (E_BAD_BOUNDARY if the
+     first one trimmed its page away)
+  */
+  /****************************************************************************/
+  void Harness::OpDoubleFree()
+  {
+    if(Live_.empty())
+      return;
+    void *Block = PickLive();
+    FreeLocal(Block);
+    if(Live_.count(Block))
+      return; //a waiting coroutine got it back
+    bool Caught = false;
+    Deallocs_++;
+    try
+    {
+      OA_ -> Free(Block);
+    }
+    catch(OAException &e)
+    {
+      Caught = e.code() == OAException::E_MULTIPLE_FREE || e.code() == OAException::E_BAD_BOUNDARY;
+    }
+    CHECK(Caught);
+  }
+
+  /****************************************************************************/
+  /*!
+    \brief
+     Frees addresses that are not blocks: inside a block, right before one
+     (pads, header or the page start) and off every page
+  */
+  /****************************************************************************/
+  void Harness::OpBadBoundary()
+  {
+    int Local = 0;
+    char *Address = reinterpret_cast<char*>(&Local);
+    unsigned How = In_.Take(3);
+    if(How != 2)
+    {
+      if(Live_.empty())
+        return;
+      char *Block = static_cast<char*>(PickLive());
+      Address = How == 0 ? Block + 1 + In_.Take(static_cast<unsigned>(ObjectSize_ - 1)) : Block - 1;
+    }
+    bool Caught = false;
+    Deallocs_++;
+    try
+    {
+      OA_ -> Free(Address);
+    }
+    catch(OAException &e)
+    {
+      Caught = e.code() == OAException::E_BAD_BOUNDARY;
+    }
+    CHECK(Caught);
+  }
+
+  /****************************************************************************/
+  /*!
+    \brief
+     Overwrites a pad byte: ValidatePages must report the block and Free
+     must refuse it. The pad is put back after.
+  */
+  /****************************************************************************/
+  void Harness::OpCorruptPad()
+  {
+    if(Live_.empty())
+      return;
+    unsigned char *Block = static_cast<unsigned char*>(PickLive());
+    unsigned char *Pad = In_.Take(2) ? Block + ObjectSize_ + In_.Take(Config_.PadBytes_)
+      : Block - 1 - In_.Take(Config_.PadBytes_);
+    unsigned char Saved = *Pad;
+    *Pad = static_cast<unsigned char>(~ObjectAllocator::PAD_PATTERN);
+    Seen_.clear();
+    CHECK(OA_ -> ValidatePages(Record) == 1);
+    CHECK(Seen_.size() == 1 && Seen_.count(Block));
+    bool Caught = false;
+    Deallocs_++;
+    try
+    {
+      OA_ -> Free(Block);
+    }
+    catch(OAException &e)
+    {
+      Caught = e.code() == OAException::E_CORRUPTED_BLOCK;
+    }
+    CHECK(Caught);
+    *Pad = Saved;
+  }
+
+  /****************************************************************************/
+  /*!
+    \brief
+     Writes to a block after freeing it: the quarantine must report it when
+     it lets the block go. Skipped while remote frees are pending: a trim
+     inside Free drains them, and they can push the block out of the
+     quarantine before it is written.
+  */
+  /****************************************************************************/
+  void Harness::OpWriteAfterFree()
+  {
+    if(Live_.empty() || Waiting_ || !Pending_.empty())
+      return;
+    unsigned char *Block = static_cast<unsigned char*>(PickLive());
+    FreeLocal(Block);
+    Block[In_.Take(static_cast<unsigned>(ObjectSize_))] ^= 0x5A;
+    Seen_.clear();
+    OA_ -> FlushQuarantine();
+    CHECK(Seen_.count(Block));
+  }
+
+#ifdef OA_COROUTINES
+  /****************************************************************************/
+  /*!
+    \brief
+     Starts a coroutine that co_awaits a block
+  */
+  /****************************************************************************/
+  void Harness::OpAllocateAsync()
+  {
+    if(Waiting_ < MAX_WAITERS)
+      WaitForBlock(*this);
+  }
+#endif
+
+  /****************************************************************************/
+  /*!
+    \brief
+     Compares the allocator with the model
+  */
+  /****************************************************************************/
+  void Harness::Verify()
+  {
+    OAStats Stats = OA_ -> GetStats();
+    CHECK(Stats.Allocations_ == Allocs_);
+    CHECK(Stats.Deallocations_ == Deallocs_);
+    CHECK(Stats.ObjectsInUse_ >= Live_.size());
+    CHECK(Stats.ObjectsInUse_ <= Live_.size() + Pending_.size());
+    if(Stats.ObjectsInUse_ == Live_.size())
+      Pending_.clear();
+    CHECK(Stats.MostObjects_ >= Stats.ObjectsInUse_);
+    CHECK(Stats.MostObjects_ >= Most_);
+    CHECK(Stats.MostObjects_ <= Allocs_);
+    CHECK(Stats.ObjectSize_ == ObjectSize_);
+    if(Config_.UseCPPMemManager_)
+      return;
+
+    CHECK(Stats.PageSize_ == PageSize_);
+    CHECK(Stats.FreeObjects_ == CountList(OA_ -> GetFreeList()));
+    CHECK(Stats.PagesInUse_ == CountList(OA_ -> GetPageList()));
+    if(Config_.MaxPages_ && !Provider_)
+      CHECK(Stats.PagesInUse_ <= Config_.MaxPages_);
+    unsigned Blocks = Stats.PagesInUse_ * Config_.ObjectsPerPage_;
+    unsigned Accounted = Stats.ObjectsInUse_ + Stats.FreeObjects_;
+    CHECK(Accounted <= Blocks);
+    CHECK(Blocks - Accounted <= Config_.QuarantineSize_);
+    if(Provider_)
+    {
+      unsigned Pages = Stats.PagesInUse_ + Sibling_ -> GetStats().PagesInUse_;
+      CHECK(Provider_ -> GetPagesInUse() == Pages);
+    }
+    //a guarded page ends on its guard, short of it only to align the blocks
+    if(Config_.GuardPages_ && !Provider_ && !Config_.AlignedPages_ && !Config_.SplitHeaders_)
+    {
+      uintptr_t OSPage = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+      uintptr_t Slack = Config_.Alignment_ > 1 ? Config_.Alignment_ : 1;
+      for(const GenericObject *Page = static_cast<const GenericObject*>(OA_ -> GetPageList()); Page; Page = Page -> Next)
+      {
+        uintptr_t End = reinterpret_cast<uintptr_t>(Page) + PageSize_;
+        CHECK((OSPage - End % OSPage) % OSPage < Slack);
+      }
+    }
+
+    //dumping scans every block, large allocators only now and then
+    if(Blocks > 64 && Step_ % FULL_CHECK)
+      return;
+    Seen_.clear();
+    CHECK(OA_ -> DumpMemoryInUse(Record) == Stats.ObjectsInUse_);
+    CHECK(Seen_.size() == Stats.ObjectsInUse_);
+    for(std::map<void*, unsigned char>::iterator It = Live_.begin(); It != Live_.end(); ++It)
+      CHECK(Seen_.count(It -> first));
+    for(std::set<const void*>::iterator It = Seen_.begin(); It != Seen_.end(); ++It)
+      CHECK(Live_.count(const_cast<void*>(*It)) || Pending_.count(const_cast<void*>(*It)));
+    Seen_.clear();
+    CHECK(OA_ -> ValidatePages(Record) == 0);
+  }
+
+  /****************************************************************************/
+  /*!
+    \brief
+     Runs operations until the input runs out
+  */
+  /****************************************************************************/
+  void Harness::Run()
+  {
+    bool Pages = !Config_.UseCPPMemManager_;
+    for(Step_ = 0; Step_ < MAX_STEPS && !In_.Done(); Step_++)
+    {
+      unsigned Op = In_.Take(100);
+      if(Op < 40)
+        OpAllocate();
+      else if(Op < 72)
+        OpFree();
+      else if(Op < 76 && Config_.RemoteFree_)
+        OpRemoteFree();
+      else if(Op < 78)
+        OA_ -> FreeEmptyPages();
+      else if(Op < 81)
+      {
+        try
+        {
+          OA_ -> Compact(Relocate, In_.Take(2) ? 0 : In_.Take(4), In_.Take(4) ? 0.0 : 1e-6);
+        }
+        catch(RelocateFailed&)
+        {
+        }
+      }
+      else if(Op < 84)
+        OA_ -> Trim();
+      else if(Op < 86)
+        OA_ -> FlushQuarantine();
+#ifdef OA_COROUTINES
+      else if(Op < 89)
+        OpAllocateAsync();
+#endif
+      else if(Op < 91 && Sibling_)
+        OpSibling();
+      else if(Op < 93 && Checked_)
+        OpDoubleFree();
+      else if(Op < 95 && Checked_)
+        OpBadBoundary();
+      else if(Op < 97 && Checked_ && Config_.PadBytes_)
+        OpCorruptPad();
+      else if(Op < 99 && Checked_ && Config_.QuarantineSize_)
+        OpWriteAfterFree();
+      else if(Pages)
+        OA_ -> DrainRemoteFrees();
+      Verify();
+    }
+  }
+
+  /****************************************************************************/
+  /*!
+    \brief
+     Gives every block back (serving the waiting coroutines on the way) so
+     the allocators are destroyed empty and nothing leaks
+  */
+  /****************************************************************************/
+  void Harness::Finish()
+  {
+    for(size_t i = 0; i < SiblingBlocks_.size(); i++)
+      Sibling_ -> Free(SiblingBlocks_[i]);
+    SiblingBlocks_.clear();
+    if(Sibling_)
+      Sibling_ -> FreeEmptyPages();
+    OA_ -> DrainRemoteFrees();
+    OA_ -> FlushQuarantine();
+    while(!Live_.empty())
+      FreeLocal(Live_.begin() -> first);
+    CHECK(Waiting_ == 0);
+    Pending_.clear();
+    Verify();
+    CHECK(OA_ -> GetStats().ObjectsInUse_ == 0);
+    Sibling_.reset();
+    OA_.reset();
+  }
+
+  /****************************************************************************/
+  /*!
+    \brief
+     One run driven by the given bytes
+  */
+  /****************************************************************************/
+  void RunOne(const uint8_t *Data, size_t Size)
+  {
+    Input In(Data, Size);
+    Harness H(In);
+    Current = &H;
+    H.Setup();
+    H.Run();
+    H.Finish();
+    Current = NULL;
+  }
+}
+
+#ifdef OA_LIBFUZZER
+/******************************************************************************/
+/*!
+  \brief
+   libFuzzer entry point
+*/
+/******************************************************************************/
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size)
+{
+  RunOne(Data, Size);
+  return 0;
+}
+#else
+/******************************************************************************/
+/*!
+  \brief
+   Runs seeds 1..N (default 1500, first argument), each on bytes from a
+   seeded generator. A second argument runs that single seed.
+*/
+/******************************************************************************/
+int main(int argc, char **argv)
+{
+  unsigned First = 1;
+  unsigned Last = argc > 1 ? static_cast<unsigned>(atoi(argv[1])) : 1500;
+  if(argc > 2)
+    First = Last = static_cast<unsigned>(atoi(argv[2]));
+  std::vector<uint8_t> Data(4096);
+  for(unsigned Seed = First; Seed <= Last; Seed++)
+  {
+    std::mt19937 Random(Seed);
+    for(size_t i = 0; i < Data.size(); i++)
+      Data[i] = static_cast<uint8_t>(Random());
+    RunOne(Data.data(), Data.size());
+  }
+  printf("oa_stress: %u seeds passed\n", Last - First + 1);
+  return 0;
+}
+#endif